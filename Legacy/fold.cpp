@@ -3,9 +3,30 @@
 #include <fstream>
 #include <utility>
 #include <string>
-#include <map>
 #include <algorithm>
-#include <set>
+#include <array>
+#include <memory>
+#include <string_view>
+#include <cstring>
+#include <cassert>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <sys/resource.h>
+
+// build with: g++ -std=c++17 -O3 -pthread fold.cpp -o fold
 
 //  cout << (float) i /321135634 << '\r' << '\b'; // progress overwite
 //  percentage thingy
@@ -13,600 +34,5653 @@
 using namespace std;
 
 typedef vector <unsigned int> intVector;
-typedef pair <unsigned int,intVector> intVectorPair;
-typedef vector <intVectorPair> top;
-typedef vector <top> tops;
 
-// declare a new vector and pass it in for intersect. Pass in children vectors, and a new size int. Size will be the size of the intersect. Intersect will be the intersect vector. Don't trust the size of this vector. It has junk. Use size instead.
-void getIntersection (vector <unsigned int> & x, vector <unsigned int> & y, unsigned int & size, vector <unsigned int> & intersect)
+// The metrics. Every thread counts into a block of its own, found through a thread_local pointer, so counting is a
+// plain increment and no cache line is shared. Blocks are registered once and outlive their threads, and a report adds
+// them up after the threads are done. Counting is always on; only trace spans, which keep an event each, are optional.
+// Spans go out in the Chrome trace format, which Perfetto reads too.
+const unsigned int sizeBuckets = 16; // intersections by the bit length of the shorter run, the last bucket taking the rest
+
+// one finished span, in microseconds from the start of the run
+struct traceEvent
 {
-    
-    sort (x.begin(),x.end());
-    sort (y.begin(),y.end());
-    
-    if (x.size() > y.size())
+    const char * name;
+    unsigned int root; // the root it was about, or ~0 for none
+    unsigned long long start;
+    unsigned long long duration;
+};
+
+// one pane search range, for finding the hot roots
+struct rootRecord
+{
+    unsigned int root;
+    unsigned long long panes;
+    unsigned long long microseconds;
+};
+
+struct threadMetrics
+{
+    unsigned int thread = 0;
+    unsigned long long intersections [sizeBuckets] = {0};
+    unsigned long long checks = 0;
+    unsigned long long checksPassed = 0;
+    unsigned long long checkTwos = 0;
+    unsigned long long checkTwosPassed = 0;
+    unsigned long long panes = 0;
+    unsigned long long bytesAllocated = 0; // pane chunks and intersection buffers, the allocations that grow with the search
+    unsigned long long buffersGrown = 0; // times a search buffer had to grow, which stops once each is big enough
+    vector <rootRecord> roots;
+    vector <traceEvent> events;
+};
+
+struct metricsRegistry
+{
+    mutex lock;
+    vector <unique_ptr <threadMetrics> > threads;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool tracing = false;
+};
+metricsRegistry metrics;
+
+// function gives back the calling thread's block, registering it the first time
+threadMetrics & metricsHere ()
+{
+    thread_local threadMetrics * mine = 0;
+    if (!mine)
     {
-        intersect.resize (x.size());
+        lock_guard <mutex> hold (metrics.lock);
+        metrics.threads.push_back (unique_ptr <threadMetrics> (new threadMetrics));
+        mine = metrics.threads.back().get();
+        mine->thread = (unsigned int) metrics.threads.size();
     }
-    else
+    return *mine;
+}
+
+unsigned long long microsecondsNow ()
+{
+    return (unsigned long long) chrono::duration_cast <chrono::microseconds> (chrono::steady_clock::now() - metrics.start).count();
+}
+
+// a span of the trace. It times its own life, and when tracing is on it is kept against its thread.
+struct traceSpan
+{
+    const char * name;
+    unsigned int root;
+    unsigned long long start;
+    
+    traceSpan (const char * spanName,unsigned int spanRoot = ~0u) : name (spanName), root (spanRoot), start (metrics.tracing ? microsecondsNow() : 0) {}
+    ~traceSpan ()
     {
-        intersect.resize (y.size());
+        if (metrics.tracing)
+        {
+            traceEvent event = {name,root,start,microsecondsNow() - start};
+            metricsHere().events.push_back (event);
+        }
     }
-    
-    vector <unsigned int>::iterator it;
-    it = set_intersection (x.begin(),x.end(),y.begin(),y.end(),intersect.begin());
-    size = (unsigned int) (it-intersect.begin()); // gives the size of intersection before you get junk
-    
-}
+};
 
-// function returns true if a branch object does not contain a given leaf
-bool doesNotContainLeaf (intVector & container, unsigned int & x)
+// procedure prints how far a long stage has got, at most once a second, and always at the end. Done and total may
+// be counts or estimated costs; the time left assumes the rest goes at the rate so far.
+struct progressMeter
 {
+    const char * stage;
+    unsigned long long total;
+    chrono::steady_clock::time_point began;
+    chrono::steady_clock::time_point last;
     
-    if (container.empty())
+    progressMeter (const char * stageName,unsigned long long stageTotal) : stage (stageName), total (stageTotal), began (chrono::steady_clock::now()), last (began) {}
+    void tick (unsigned long long done)
     {
-        return true;
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (done == total || now - last >= chrono::seconds (1))
+        {
+            double seconds = chrono::duration <double> (now - began).count();
+            unsigned int percent = total ? (unsigned int) (done * 100 / total) : 100;
+            cerr << stage << ": " << percent << "%";
+            if (done > 0 && done < total)
+            {
+                cerr << ", about " << (unsigned long long) (seconds * (total - done) / done + 0.5) << "s left";
+            }
+            cerr << endl;
+            last = now;
+        }
     }
-    unsigned int i=0;
+};
+
+// an array the index keeps its data in. It either owns its memory, while it is being built, or looks straight into a
+// mapped snapshot, after a warm start. Reading is the same either way; only owned arrays may be written.
+template <typename T>
+struct flatArray
+{
+    vector <T> owned;
+    const T * items = 0;
+    size_t count = 0;
     
-    while (i<container.size()-1 && container[i] != x)
+    flatArray () {}
+    flatArray (const flatArray & other) { *this = other; }
+    flatArray & operator = (const flatArray & other)
     {
-        i++;
+        owned = other.owned;
+        items = other.items == other.owned.data() ? owned.data() : other.items;
+        count = other.count;
+        return *this;
     }
-    return (container[i] != x);
     
-}
+    void assign (size_t n,const T & value) { owned.assign (n,value); items = owned.data(); count = n; }
+    void resize (size_t n) { owned.resize (n); items = owned.data(); count = n; }
+    void view (const T * at,size_t n) { owned.clear(); owned.shrink_to_fit(); items = at; count = n; }
+    void take (vector <T> & from) { owned.swap (from); items = owned.data(); count = owned.size(); }
+    
+    size_t size () const { return count; }
+    bool empty () const { return count == 0; }
+    const T * data () const { return items; }
+    const T * begin () const { return items; }
+    const T * end () const { return items + count; }
+    const T & operator [] (size_t i) const { return items[i]; }
+    T & operator [] (size_t i) { assert (items == owned.data()); return owned[i]; }
+};
+
+// a read only run of ids sitting inside the index. Nothing is copied, it just points at the flat arrays.
+struct idSpan
+{
+    const unsigned int * first;
+    const unsigned int * last;
+    
+    unsigned int size () const { return (unsigned int) (last - first); }
+    bool empty () const { return first == last; }
+    const unsigned int & operator [] (unsigned int i) const { return first[i]; }
+    const unsigned int * begin () const { return first; }
+    const unsigned int * end () const { return last; }
+};
+
+// an open addressing set of packed keys. A slot of all ones is free; no packed key is ever all ones.
+struct keySet
+{
+    flatArray <unsigned long long> slots;
+    unsigned long long mask;
+};
+
+// a blocked Bloom filter. Each key sets four bits of one 64 bit word, so a test touches a single cache line.
+struct bloomFilter
+{
+    flatArray <unsigned long long> words;
+    unsigned long long mask;
+};
+
+// constant time "does this bigram / trigram exist" sets, built from the index at load time for the stacking checks.
+// Trigrams pack three 21 bit ids into one key, so the trigram set is only built when the vocabulary fits;
+// otherwise lineUpTwo goes back to the index. The Bloom filters are optional and sit in front of the tables.
+struct membership
+{
+    keySet bigrams;
+    keySet trigrams;
+    bloomFilter bigramFilter;
+    bloomFilter trigramFilter;
+    bool packedTrigrams;
+    bool filtered;
+};
+
+// The packed leaves, kept instead of the plain leaves array with --compress. Leaves are cut into blocks of leafBlock,
+// counted over the whole array rather than per run. A block's first leaf is kept whole in blockFirst; the rest follow
+// in bytes from blockStart as varints of the zigzagged difference from the leaf before, which is small inside a run and
+// may go negative where a new run starts in mid block. blockFirst and blockStart are the skip pointers: decoding starts
+// at any block, and since the blocks of a run begin with ascending leaves, a probe jumps over blocks without reading them.
+const unsigned int leafBlock = 64;
+
+struct packedLeaves
+{
+    flatArray <unsigned char> bytes;
+    flatArray <unsigned int> blockFirst;
+    flatArray <unsigned long long> blockStart; // byte offset of each block's second leaf
+};
+
+// the immutable adjacency index, built once after loading. It is laid out compressed sparse row style.
+// Root r owns the branch slots [branchOffsets[r], branchOffsets[r+1]) and branch slot s owns the leaves [leafOffsets[s], leafOffsets[s+1]).
+// Branches are sorted within their root and leaves are sorted within their branch, so every lookup is a slice or a binary search.
+// Because the leaf runs of one root sit next to each other, a root's leaves also form one contiguous slice.
+// With --compress the leaves are packed instead, and are read with leafValue, unpackLeaves and leafRun, which work on both.
+// The bigrams are also kept inverted, the same way: word w's predecessors are [predecessorOffsets[w], predecessorOffsets[w+1])
+// of predecessors, sorted, for walking back from a word as cheaply as the branches walk on from one.
+struct adjacency
+{
+    flatArray <unsigned int> branchOffsets; // one per word, plus one
+    flatArray <unsigned int> branches; // the word that follows the root
+    flatArray <unsigned int> predecessorOffsets; // one per word, plus one
+    flatArray <unsigned int> predecessors; // the word that comes before
+    flatArray <unsigned int> leafOffsets; // one per branch slot, plus one
+    flatArray <unsigned int> leaves; // the word that follows root then branch, empty when packed
+    packedLeaves packed; // the same leaves compressed, empty unless packed
+    bool compressed = false;
+    flatArray <unsigned int> firstSeen; // when ids are renumbered by frequency, the id each word had in first seen order
+    membership members; // the same bigrams and trigrams again, as hashed sets
+};
 
-// procedure that places branch members from root into vector for easy retrieval. Only used for E so far.
-void getChildren(top & root,vector <unsigned int> & children)
+// one 3x3 pane, cells a to i in reading order. Plain fixed size data, so panes can sit back to back in memory.
+typedef array <unsigned int,9> pane;
+
+// function returns the pane flipped about its a, e, i diagonal: rows become columns. Rows and columns are both
+// trigrams, so a transposed pane is a pane too, and a stack transposed pane by pane is a stack.
+pane transposePane (const pane & frame)
 {
-    for (unsigned int i = 0;i<root.size();i++)
+    pane flipped;
+    for (unsigned int row = 0;row<3;row++)
     {
-        children.push_back (root[i].first);
+        for (unsigned int col = 0;col<3;col++)
+        {
+            flipped[col*3+row] = frame[row*3+col];
+        }
     }
+    return flipped;
+}
+
+// function returns the cell of a pane that cell k of its transpose holds
+inline unsigned int transposedCell (unsigned int k)
+{
+    return (k%3)*3 + k/3;
 }
 
-// function returns the index of a branch for the root
-unsigned int findBranch (top & root,unsigned int & x)
+// panes kept in fixed size chunks. Growing never moves a stored pane, and clear() keeps the chunks,
+// so a store that is reused for the next root or task stops going to the allocator once it is big enough.
+struct paneStore
 {
-    unsigned int i = 0;
+    static const size_t chunkSize = 1 << 16; // panes per chunk, a bit over 2MB
+    
+    vector <unique_ptr <pane []> > chunks;
+    size_t count = 0;
+    
+    size_t size () const { return count; }
+    bool empty () const { return count == 0; }
+    void clear () { count = 0; }
+    pane & operator [] (size_t i) { return chunks[i / chunkSize][i % chunkSize]; }
+    const pane & operator [] (size_t i) const { return chunks[i / chunkSize][i % chunkSize]; }
     
-    while (root[i].first != x && i != root.size())
+    void push (const pane & frame)
     {
-        i++;
+        if (count == chunks.size() * chunkSize)
+        {
+            chunks.push_back (unique_ptr <pane []> (new pane [chunkSize]));
+            metricsHere().bytesAllocated += chunkSize * sizeof (pane);
+        }
+        (*this)[count++] = frame;
     }
-    if (i == root.size())
+};
+
+// returned by findBranch when the branch is not on the root, and by lookUp when the word is not known
+const unsigned int notFound = ~0u;
+
+// the input file, mapped read only. Words in the dictionary point straight into it, so it stays mapped for the whole run.
+struct mappedFile
+{
+    const char * data;
+    size_t size;
+};
+
+// the dictionary. Words are interned into an open addressing table of ids. The hash of every word is kept
+// so the table can grow without touching the strings again, and probes compare hashes before bytes.
+struct vocabulary
+{
+    mappedFile file;
+    vector <string_view> words; // id to word
+    vector <unsigned long long> hashes; // id to hash of the word
+    vector <unsigned long long> counts; // id to how often the word comes up in the indexed part of the file
+    vector <unsigned int> slots; // the table itself. Holds ids, notFound when empty.
+    bool byFrequency = false; // ids were renumbered most common first, rather than in the order first seen
+    size_t indexed = 0; // bytes of the file the index covers. Less than all of it when words were added on since.
+};
+
+// The intersection engine. Every E/H/F/I step is an intersection of two sorted runs, and run lengths are very skewed
+// (common words have thousands of successors, rare ones a couple), so the strategy is picked by size.
+// Comparable sizes use a block compare merge, vectorized when the processor has AVX2 or AVX-512.
+// When one run is much longer the short one gallops through it instead.
+// Kernels write whole vector blocks, so an output buffer needs intersectPadding spare ids past the real answer.
+// Passing a null output only counts.
+const unsigned int intersectPadding = 16;
+const unsigned int gallopRatio = 32; // one run this many times longer than the other means gallop
+
+typedef unsigned int (* intersectKernel) (const unsigned int * x, unsigned int xSize, const unsigned int * y, unsigned int ySize, unsigned int * out);
+
+// function is the plain merge. It is the tail of every vector kernel and the fallback everywhere else.
+unsigned int intersectScalar (const unsigned int * x, unsigned int xSize, const unsigned int * y, unsigned int ySize, unsigned int * out)
+{
+    unsigned int i = 0, j = 0, size = 0;
+    
+    while (i < xSize && j < ySize)
     {
-        cout << "over the limit in findBranch. Object not found/////////////////////////////////////////////////";
+        if (x[i] < y[j])
+        {
+            i++;
+        }
+        else if (y[j] < x[i])
+        {
+            j++;
+        }
+        else
+        {
+            if (out)
+            {
+                out[size] = x[i];
+            }
+            size++;
+            i++;
+            j++;
+        }
     }
-    return i;
+    return size;
 }
 
-// procedure acts upon main and sweep coordinates directly, in order to find the next frame configuration
-void iterateCoordinates (top & root,pair <unsigned int, unsigned int> & mainCoordinates,pair <unsigned int, unsigned int> & sweepCoordinates)
+// function walks the short run and finds each of its ids in the long run by exponential then binary search,
+// starting from where the last one was found
+unsigned int intersectGalloping (const unsigned int * small, unsigned int smallSize, const unsigned int * large, unsigned int largeSize, unsigned int * out)
 {
-    if (sweepCoordinates.first == root.size() -1 && sweepCoordinates.second == root[root.size() -1].second.size() -1)
+    unsigned int low = 0, size = 0;
+    
+    for (unsigned int i = 0;i < smallSize && low < largeSize;i++)
     {
-        // then sweep is at end. Iterate main once and set sweep to main.
+        unsigned int target = small[i];
         
-        // determine if main.second is at end
-        if (mainCoordinates.second == root[mainCoordinates.first].second.size() -1)
+        // gallop until the step passes the target
+        unsigned int step = 1;
+        unsigned int high = low;
+        while (high < largeSize && large[high] < target)
         {
-            mainCoordinates.second = 0;
-            mainCoordinates.first++;
+            low = high + 1;
+            high += step;
+            step <<= 1;
         }
-        else //main.second is not at end
+        if (high > largeSize)
         {
-            mainCoordinates.second++;
+            high = largeSize;
         }
-        sweepCoordinates = mainCoordinates;
-    }
-    else
-    {
-        //determine if sweep.second is at end
-        if (sweepCoordinates.second == root[sweepCoordinates.first].second.size()-1)
+        
+        low = (unsigned int) (lower_bound (large + low,large + high,target) - large);
+        if (low < largeSize && large[low] == target)
         {
-            // iterate first and reset second
-            sweepCoordinates.first++;
-            sweepCoordinates.second = 0;
+            if (out)
+            {
+                out[size] = target;
+            }
+            size++;
+            low++;
         }
-        else // sweep.second is not at end
+    }
+    return size;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+// table of lane shuffles that pack the matched lanes of an 8 lane block to the front, one per match mask
+struct packTable
+{
+    unsigned int lanes [256][8];
+    
+    packTable ()
+    {
+        for (unsigned int mask = 0;mask < 256;mask++)
         {
-            // iterate second, leave first alone
-            sweepCoordinates.second++;
+            unsigned int n = 0;
+            for (unsigned int lane = 0;lane < 8;lane++)
+            {
+                if (mask & (1u << lane))
+                {
+                    lanes[mask][n++] = lane;
+                }
+            }
+            while (n < 8)
+            {
+                lanes[mask][n++] = 0;
+            }
         }
     }
-}
+};
+const packTable avx2Pack;
 
-// procedure that creates a string to int dictionary entry for every unique word in the file
-void loadDictionary(tops & trees,map <string,unsigned int> & dictionary)
+// function compares 8 ids of x against all 8 rotations of 8 ids of y, packs the matches of x and moves on
+// whichever block ends lower. Both runs hold unique ids, so no match is ever counted twice.
+__attribute__ ((target ("avx2")))
+unsigned int intersectAvx2 (const unsigned int * x, unsigned int xSize, const unsigned int * y, unsigned int ySize, unsigned int * out)
 {
-    string word;
-    typedef pair <string,unsigned int> stringInt; // this is a dictionary entry
-    fstream vocab; vocab.open ("input.txt",fstream::in); // open the stream
-    while (!vocab.eof())
+    unsigned int i = 0, j = 0, size = 0;
+    const __m256i rotate = _mm256_setr_epi32 (1,2,3,4,5,6,7,0);
+    
+    while (i + 8 <= xSize && j + 8 <= ySize)
     {
-        vocab >> word;
+        __m256i blockX = _mm256_loadu_si256 ((const __m256i *) (x + i));
+        __m256i blockY = _mm256_loadu_si256 ((const __m256i *) (y + j));
+        
+        __m256i hits = _mm256_cmpeq_epi32 (blockX,blockY);
+        for (unsigned int r = 1;r < 8;r++)
+        {
+            blockY = _mm256_permutevar8x32_epi32 (blockY,rotate);
+            hits = _mm256_or_si256 (hits,_mm256_cmpeq_epi32 (blockX,blockY));
+        }
+        unsigned int mask = (unsigned int) _mm256_movemask_ps (_mm256_castsi256_ps (hits));
+        
+        if (out)
+        {
+            __m256i pack = _mm256_loadu_si256 ((const __m256i *) avx2Pack.lanes[mask]);
+            _mm256_storeu_si256 ((__m256i *) (out + size),_mm256_permutevar8x32_epi32 (blockX,pack));
+        }
+        size += (unsigned int) __builtin_popcount (mask);
         
-        if (dictionary.count (word) == 0)
+        unsigned int lastX = x[i+7], lastY = y[j+7];
+        if (lastX <= lastY)
         {
-            dictionary.insert (stringInt (word,dictionary.size()));
+            i += 8;
+        }
+        if (lastY <= lastX)
+        {
+            j += 8;
         }
     }
+    return size + intersectScalar (x + i,xSize - i,y + j,ySize - j,out ? out + size : 0);
 }
 
-// procedure populates a reverse dictionary, that takes an int and gives back a string, for human readable output
-void reverseEntries (map <string,unsigned int> & dictionary, map <unsigned int,string> & reverseDictionary)
+// function is the 16 lane version. AVX-512 packs the matches itself, so there is no table.
+__attribute__ ((target ("avx512f")))
+unsigned int intersectAvx512 (const unsigned int * x, unsigned int xSize, const unsigned int * y, unsigned int ySize, unsigned int * out)
 {
-    typedef pair <unsigned int,string> intString;
-    //this creates the reverse dictionary
-    map <string,unsigned int>::iterator i;
+    unsigned int i = 0, j = 0, size = 0;
     
-    for (i=dictionary.begin();i!=dictionary.end();i++)
+    while (i + 16 <= xSize && j + 16 <= ySize)
     {
-        unsigned int num = i-> second;
-        string word = i->first;
+        __m512i blockX = _mm512_loadu_si512 ((const void *) (x + i));
+        __m512i blockY = _mm512_loadu_si512 ((const void *) (y + j));
+        
+        __mmask16 hits = _mm512_cmpeq_epi32_mask (blockX,blockY);
+        for (unsigned int r = 1;r < 16;r++)
+        {
+            blockY = _mm512_mask_alignr_epi32 (blockY,0xFFFF,blockY,blockY,1); // rotate one lane
+            hits = (__mmask16) (hits | _mm512_cmpeq_epi32_mask (blockX,blockY));
+        }
+        
+        if (out)
+        {
+            _mm512_mask_compressstoreu_epi32 ((void *) (out + size),hits,blockX);
+        }
+        size += (unsigned int) __builtin_popcount ((unsigned int) hits);
         
-        reverseDictionary.insert (intString (num,word));
+        unsigned int lastX = x[i+15], lastY = y[j+15];
+        if (lastX <= lastY)
+        {
+            i += 16;
+        }
+        if (lastY <= lastX)
+        {
+            j += 16;
+        }
     }
+    return size + intersectAvx2 (x + i,xSize - i,y + j,ySize - j,out ? out + size : 0);
 }
 
-// function returns true if a root does not have a value x as a branch (child)
-bool doesNotContain (top & root,unsigned int x)
+// function picks the widest block kernel this processor runs. Asked once, when the kernel is first needed.
+intersectKernel pickBlockKernel ()
 {
-    unsigned int i=0;
-    if (root.size() ==0)
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f"))
     {
-        return true;
+        return intersectAvx512;
     }
-    else
+    if (__builtin_cpu_supports ("avx2"))
     {
-        while (i < root.size()-1 && root[i].first != x)
-        {
-            i++;
-        }
-        
-        return (root[i].first != x);
+        return intersectAvx2;
     }
+    return intersectScalar;
+}
+#else
+intersectKernel pickBlockKernel ()
+{
+    return intersectScalar;
 }
+#endif
 
-// applies filtering and outputs to stdout sloppily formatted data
-void outPutAll(vector<unsigned int> frame, map <unsigned int,string> & reverseDictionary)
+// function runs the best strategy for the two sizes. out may be null to only count.
+unsigned int intersectRuns (const unsigned int * x, unsigned int xSize, const unsigned int * y, unsigned int ySize, unsigned int * out)
 {
-    // check to see if it is junk first
-    multiset <int> words;
-    bool repeat = false;
+    static const intersectKernel blockKernel = pickBlockKernel ();
     
-    for (unsigned int i=0;i<frame.size();i++)
+    if (xSize == 0 || ySize == 0)
     {
-        words.insert(frame[i]);
+        return 0;
     }
-    
-    unsigned int iter =0;
-    while (iter<frame.size() && (!repeat))
+    if ((unsigned long long) xSize * gallopRatio < ySize)
     {
-        if (words.count (frame[iter]) > 1)
-        {
-            repeat = true;
-        }
-        iter++;
+        return intersectGalloping (x,xSize,y,ySize,out);
     }
-    
-    if (!repeat)
+    if ((unsigned long long) ySize * gallopRatio < xSize)
     {
-        cout << "////////////////"<<endl;
-        
-        cout << reverseDictionary[frame[0]] << " " << reverseDictionary[frame[1]] << " " << reverseDictionary[frame[2]] << endl;
-        cout << reverseDictionary[frame[3]] << " " << reverseDictionary[frame[4]] << " " << reverseDictionary[frame[5]] << endl;
-        cout << reverseDictionary[frame[6]] << " " << reverseDictionary[frame[7]] << " " << reverseDictionary[frame[8]] << endl;
+        return intersectGalloping (y,ySize,x,xSize,out);
     }
+    return blockKernel (x,xSize,y,ySize,out);
 }
 
-
-// function returns the number of runs on a given root. Saves lots of computing with math!
-unsigned int maximum (top root)
+// procedure makes a search buffer at least size ids long. Buffers only ever grow, and then by at least doubling, so
+// one that is kept around grows a few dozen times at most and is allocation free from then on.
+void growBuffer (intVector & buffer,size_t size)
 {
-    unsigned int grandchildren = 0;
-    unsigned int i = 0;
-    
-    while (i < root.size())
+    if (buffer.size() < size)
     {
-        grandchildren += root[i].second.size();
-        i++;
+        threadMetrics & counts = metricsHere();
+        size_t had = buffer.capacity();
+        buffer.resize (max (size,2 * buffer.size()));
+        counts.bytesAllocated += (buffer.capacity() - had) * sizeof (unsigned int);
+        counts.buffersGrown++;
     }
-    return ((grandchildren * (grandchildren+1))/2);
 }
 
-// procedure places into the frame new values, based upon main and sweep coordinates gotten from iterateCoordinates
-void getNextFrame (unsigned int & current,top & root,vector <unsigned int> & frame,pair <unsigned int, unsigned int> & mainCoordinates,pair <unsigned int, unsigned int> & sweepCoordinates,bool & ranBefore)
+// function intersects two sorted runs of ids into a buffer the caller owns, and returns the size of the intersection.
+// Nothing is sorted here: the index keeps every run sorted when it is built, and debug builds check it.
+// The buffer only ever grows, so a caller that keeps it around stops allocating once it is big enough.
+// Don't trust the size of the buffer. It has junk past the returned size.
+unsigned int getIntersection (idSpan x, idSpan y, intVector & intersect)
 {
-    // This bool prevents missing the first one.
-    if (ranBefore)
+    assert (is_sorted (x.begin(),x.end()) && is_sorted (y.begin(),y.end()));
+    
+    unsigned int shorter = x.size() < y.size() ? x.size() : y.size();
+    growBuffer (intersect,shorter + intersectPadding);
+    threadMetrics & counts = metricsHere();
+    unsigned int bucket = 0;
+    while (bucket+1 < sizeBuckets && (shorter >> bucket) != 0)
     {
-        iterateCoordinates (root,mainCoordinates,sweepCoordinates);
+        bucket++;
     }
+    counts.intersections[bucket]++;
     
-    frame [0] = current; // a
-    frame [1] = root [mainCoordinates.first].first; // b
-    frame [2] = root [mainCoordinates.first].second [mainCoordinates.second]; // c
-    frame [3] = root [sweepCoordinates.first].first; // d
-    frame [6] = root [sweepCoordinates.first].second [sweepCoordinates.second]; // g
-    
-    // for next time
-    ranBefore = true;
+    return intersectRuns (x.begin(),x.size(),y.begin(),y.size(),intersect.data()); // gives the size of intersection before you get junk
+}
+
+// function gives back only the size of the intersection, for when the ids themselves are not needed
+unsigned int countIntersection (idSpan x, idSpan y)
+{
+    assert (is_sorted (x.begin(),x.end()) && is_sorted (y.begin(),y.end()));
     
+    return intersectRuns (x.begin(),x.size(),y.begin(),y.size(),0);
+}
+
+// function gives back the branches (children) of a root as a slice of the index
+idSpan getChildren (const adjacency & trees,unsigned int root)
+{
+    idSpan children;
+    children.first = trees.branches.data() + trees.branchOffsets[root];
+    children.last = trees.branches.data() + trees.branchOffsets[root+1];
+    return children;
 }
 
+// function gives back the words that come before a word, sorted, as a slice of the inverted index
+idSpan getParents (const adjacency & trees,unsigned int word)
+{
+    idSpan parents;
+    parents.first = trees.predecessors.data() + trees.predecessorOffsets[word];
+    parents.last = trees.predecessors.data() + trees.predecessorOffsets[word+1];
+    return parents;
+}
 
+// function gives back the leaves (grandchildren) hanging off of a branch slot. Plain leaves only.
+idSpan getLeaves (const adjacency & trees,unsigned int slot)
+{
+    assert (!trees.compressed);
+    idSpan leaves;
+    leaves.first = trees.leaves.data() + trees.leafOffsets[slot];
+    leaves.last = trees.leaves.data() + trees.leafOffsets[slot+1];
+    return leaves;
+}
 
-// prepares for the search phase. Includes creation of necessary data structures from stream, and population of dictionaries.
-void load (tops & trees,  map <unsigned int,string> &  reverseDictionary, map <string,unsigned int>  &dictionary)
+// function gives back every leaf under a root. They are contiguous, so this is one slice. Plain leaves only.
+idSpan getGrandchildren (const adjacency & trees,unsigned int root)
 {
-    fstream in; in.open ("input.txt",fstream::in); // open the stream
-    string word,oneBack,twoBack; // incoming strings
-   
-    
-    loadDictionary (trees,dictionary);
-    cout << "dictionary loaded"<<endl;
-    
-    trees.resize(dictionary.size());
-    for (unsigned int temp = 0;temp<dictionary.size();temp++)
+    assert (!trees.compressed);
+    idSpan grandchildren;
+    grandchildren.first = trees.leaves.data() + trees.leafOffsets[trees.branchOffsets[root]];
+    grandchildren.last = trees.leaves.data() + trees.leafOffsets[trees.branchOffsets[root+1]];
+    return grandchildren;
+}
+
+// function gives back how many leaves there are under a root, packed or not
+unsigned int grandchildCount (const adjacency & trees,unsigned int root)
+{
+    return trees.leafOffsets[trees.branchOffsets[root+1]] - trees.leafOffsets[trees.branchOffsets[root]];
+}
+
+// a place in the packed leaves, read forwards one leaf at a time
+struct leafReader
+{
+    const unsigned char * next; // the varint of the leaf after this one
+    unsigned int at; // which leaf
+    unsigned int value;
+};
+
+// procedure puts a reader on the first leaf of a block
+void seekBlock (const packedLeaves & packed,unsigned int block,leafReader & reader)
+{
+    reader.next = packed.bytes.data() + packed.blockStart[block];
+    reader.at = block * leafBlock;
+    reader.value = packed.blockFirst[block];
+}
+
+// procedure moves a reader on one leaf. Only call this when there is a next leaf.
+void stepLeaf (const packedLeaves & packed,leafReader & reader)
+{
+    reader.at++;
+    if (reader.at % leafBlock == 0)
     {
-        top dummy;
-        trees[temp] = dummy;
+        seekBlock (packed,reader.at / leafBlock,reader);
+        return;
     }
     
-    in >> twoBack;
-    in >> oneBack;
-    
-    // twoBack is the first word, and is therefore only a root.
-    // oneBack is a branch on twoBack.
-    intVectorPair temp;
-    temp.first = dictionary[oneBack];
-    temp.second.clear();
-    trees[dictionary[twoBack]].push_back(temp);
+    unsigned int zigzag = 0;
+    unsigned int shift = 0;
+    unsigned char byte;
+    do
+    {
+        byte = *reader.next++;
+        zigzag |= (unsigned int) (byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    reader.value += (zigzag >> 1) ^ (0u - (zigzag & 1)); // wraps round for a step down
+}
+
+// procedure puts a reader on any leaf, decoding from the start of its block
+void seekLeaf (const packedLeaves & packed,unsigned int leaf,leafReader & reader)
+{
+    seekBlock (packed,leaf / leafBlock,reader);
+    while (reader.at < leaf)
+    {
+        stepLeaf (packed,reader);
+    }
+}
+
+// function gives back one leaf, by where it is in the index
+unsigned int leafValue (const adjacency & trees,unsigned int leaf)
+{
+    if (!trees.compressed)
+    {
+        return trees.leaves[leaf];
+    }
+    leafReader reader;
+    seekLeaf (trees.packed,leaf,reader);
+    return reader.value;
+}
+
+// function gives back the leaves [begin, end) of the index as a run. Plain leaves are a slice; packed ones are decoded
+// into out, which only grows.
+idSpan unpackLeaves (const adjacency & trees,unsigned int begin,unsigned int end,intVector & out)
+{
+    if (!trees.compressed)
+    {
+        idSpan leaves = {trees.leaves.data() + begin,trees.leaves.data() + end};
+        return leaves;
+    }
     
-    // now to construct the data structure
-    while (!in.eof())
+    growBuffer (out,end - begin);
+    if (begin < end)
     {
-        in >> word;
-        // place the new word onto the correct root
-        if (doesNotContain (trees[dictionary[oneBack]],dictionary[word]))
-        {
-            intVectorPair branch;
-            branch.first = dictionary[word];
-            branch.second.clear();
-            trees[dictionary[oneBack]].push_back (branch);
-        }
-        
-        // place the new word onto the correct branch
-        
-        unsigned int i = findBranch (trees[dictionary[twoBack]],dictionary[oneBack]);
-        
-        if (doesNotContainLeaf (trees[dictionary[twoBack]][i].second,dictionary[word]))
+        leafReader reader;
+        seekLeaf (trees.packed,begin,reader);
+        out[0] = reader.value;
+        for (unsigned int k = 1;k<end-begin;k++)
         {
-            trees[dictionary[twoBack]][i].second.push_back(dictionary[word]);
+            stepLeaf (trees.packed,reader);
+            out[k] = reader.value;
         }
-        
-        // update the values (loop constant)
-        twoBack = oneBack;
-        oneBack = word;
     }
-    
-    // the final branch that was put on needs to be deleted.
-    // this branch was put onto the final root that is talked about, and
-    // it is the last entry.
-    trees[dictionary[word]].pop_back(); // word is what used to be oneBack
-    
-    // now that trees is loaded, make the reverse dictionary
-    reverseEntries (dictionary,reverseDictionary);
+    idSpan leaves = {out.data(),out.data() + (end - begin)};
+    return leaves;
 }
 
-void getSquare (unsigned int current, map <unsigned int, string> &reverseDictionary, tops & trees, vector <vector <unsigned int> > & rootResults)
+// function walks the sorted ids y through the packed leaves [begin, end), one sorted run, and gives back how many are
+// there, writing them to out unless it is null. Whenever the next block of the run starts at or before the id looked
+// for, the reader jumps to the last such block on the skip pointers, so it only decodes blocks that might hold an id.
+unsigned int probeLeaves (const packedLeaves & packed,unsigned int begin,unsigned int end,const unsigned int * y,unsigned int ySize,unsigned int * out)
 {
+    if (begin == end)
+    {
+        return 0;
+    }
     
-    //   cout << "current: "<< current<<endl; // rough idea of progress. Very jumpy.
-    pair <unsigned int, unsigned int> mainCoordinates;
-    pair <unsigned int,unsigned int> sweepCoordinates;
-    
-    mainCoordinates.first = 0;
-    mainCoordinates.second = 0;
-    sweepCoordinates = mainCoordinates;
-    
-    unsigned int max = maximum (trees[current]);
-    bool ranBefore = false;
-    
-    for (unsigned int pos = 0;pos < max; pos++)
+    const unsigned int * firsts = packed.blockFirst.data();
+    unsigned int lastBlock = (end-1) / leafBlock;
+    unsigned int found = 0;
+    leafReader reader;
+    seekLeaf (packed,begin,reader);
+    for (unsigned int k = 0;k<ySize;k++)
     {
-        vector <unsigned int> frame (9,1234578);
-        getNextFrame (current,trees[current],frame,mainCoordinates,sweepCoordinates,ranBefore);/////////////////////////////////////////////
-        
-        ///////////preparing to get
-        ///////////E/////////////////////////////////////////////////////////////
-        vector <unsigned int> childrenOfB;
-        vector <unsigned int> childrenOfD;
-        
-        getChildren(trees[frame[1]],childrenOfB); // gets the children of root B.
-        getChildren (trees[frame[3]],childrenOfD); // gets the children of root D.
-        
-        // variables to be filled by intersect:
-        vector <unsigned int> intersectForE;
-        unsigned int sizeOfIntersectForE;
-        
-        getIntersection (childrenOfB,childrenOfD,sizeOfIntersectForE,intersectForE);
+        unsigned int block = reader.at / leafBlock;
+        if (block < lastBlock && firsts[block+1] <= y[k])
+        {
+            unsigned int to = (unsigned int) (upper_bound (firsts + block + 1,firsts + lastBlock + 1,y[k]) - firsts) - 1;
+            seekBlock (packed,to,reader);
+        }
+        while (reader.value < y[k] && reader.at+1 < end)
+        {
+            stepLeaf (packed,reader);
+        }
         
-        for (unsigned int iterE = 0; iterE < sizeOfIntersectForE; iterE++)
+        if (reader.value == y[k])
         {
-            
-            frame[4] = intersectForE[iterE];
-            //we need the BE children
-            unsigned int e = findBranch (trees[frame[1]],frame[4]);
-            vector <unsigned int> childrenOfBE (trees[frame[1]][e].second);
-            
-            // we also need the children of G
-            vector <unsigned int> childrenOfG;
-            getChildren (trees[frame[6]],childrenOfG);
-            
-            // variables to be filled by intersect:
-            vector <unsigned int> intersectForH;
-            unsigned int sizeOfIntersectForH;
-            
-            getIntersection (childrenOfBE, childrenOfG,sizeOfIntersectForH,intersectForH);
-            
-            for (unsigned int iterH = 0; iterH < sizeOfIntersectForH;iterH++)
+            if (out)
             {
-                frame[7] = intersectForH[iterH]; // assign H, then go on to get possible F values
-                
-                ////////////preparing for
-                ////////////F//////////////////////////////
-                
-                // we need the de children.
-                unsigned int de = findBranch (trees[frame[3]],frame[4]);
-                vector <unsigned int> childrenOfDE (trees[frame[3]][de].second);
-                
-                //now we need the children of C
-                vector <unsigned int> childrenOfC;
-                getChildren (trees[frame[2]],childrenOfC);
-                
-                //Now here are the target variables:
-                vector <unsigned int> intersectForF;
-                unsigned int sizeOfIntersectForF;
-                
-                getIntersection (childrenOfDE,childrenOfC,sizeOfIntersectForF,intersectForF);
-                
-                for (unsigned int iterF = 0; iterF<sizeOfIntersectForF; iterF++)
-                {
-                    frame[5] = intersectForF[iterF]; // assign F, then go on to get possible I values
-                    
-                    ////////////preparing for//////////
-                    ////////////I  //////////////////////////////////////
-                    
-                    // we need the cf children
-                    unsigned int cf = findBranch (trees[frame[2]],frame[5]);
-                    vector <unsigned int> childrenOfCF (trees[frame[2]][cf].second); // fancy copy constructor. C++ is incredible.
-                    
-                    // we need the gh children
-                    unsigned int gh = findBranch (trees[frame[6]],frame[7]);
-                    vector <unsigned int> childrenOfGH (trees[frame[6]][gh].second);
-                    
-                    // Here are the data the we get from getIntersection
-                    vector <unsigned int> intersectForI;
-                    unsigned int sizeOfIntersectForI;
-                    
-                    getIntersection (childrenOfCF, childrenOfGH, sizeOfIntersectForI, intersectForI);
-                    
-                    for (unsigned int iteri = 0;iteri < sizeOfIntersectForI;iteri++)
-                    {
-                        frame[8] = intersectForI[iteri];
-                        
-                        //outPutAll (frame,reverseDictionary); // This is for stopping at the squares for a simple readout
-                        
-                        //Here we will push the frame back into a results vector. This is why we moved the frame declaration to a lower scope
-                        rootResults.push_back(frame);
-                        
-                    }
-                }
+                out[found] = y[k];
             }
+            found++;
+        }
+        else if (reader.value < y[k])
+        {
+            break; // the run is used up
         }
     }
-    
+    return found;
 }
 
-bool lineUp (unsigned int &x, unsigned int & y, tops &trees)
+// function gives back the leaves of a branch slot, to be intersected with other (which may be null). Plain leaves are
+// a slice of the index. Packed leaves are decoded into scratch, all of them unless other is so much the shorter that
+// galloping would have been used; then other is probed through the blocks instead and only the leaves it shares come back.
+idSpan leafRun (const adjacency & trees,unsigned int slot,const idSpan * other,intVector & scratch)
 {
-    // first to see if y is a branch on x
-    unsigned int i = 0;
-    
-    while (trees[x][i].first != y && i != trees[x].size()) // looking to see if y is ever a child of x
+    unsigned int begin = trees.leafOffsets[slot];
+    unsigned int end = trees.leafOffsets[slot+1];
+    if (!trees.compressed || !other || (unsigned long long) other->size() * gallopRatio >= end - begin)
     {
-        i++;
+        return unpackLeaves (trees,begin,end,scratch);
     }
-    return (!(i == trees[x].size())); //This will be true if it is found, and there is a lineup
-    
-    // If we make it down here we can assume that i is the branch value
-    //trees[x][i].second is the grandchildren vector
-    
-   // return (find (trees[x][i].second.begin(),trees[x][i].second.end(),z) != trees[x][i].second.end());
-    
     
+    growBuffer (scratch,other->size());
+    unsigned int found = probeLeaves (trees.packed,begin,end,other->begin(),other->size(),scratch.data());
+    idSpan shared = {scratch.data(),scratch.data() + found};
+    return shared;
 }
 
-bool check (vector <unsigned int> &first, vector <unsigned int> &second, tops &trees)
+// function returns true if z hangs off of the branch slot
+bool hasLeaf (const adjacency & trees,unsigned int slot,unsigned int z)
 {
-    //first[0] second [0] third[0] and so on need to exist
-    for (unsigned int i=0;i<9;i++)
+    if (!trees.compressed)
     {
-        if (!lineUp (first[i],second[i],trees))
-        {
-            return false;
-        }
+        idSpan leaves = getLeaves (trees,slot);
+        return binary_search (leaves.begin(),leaves.end(),z);
     }
-    return true;
-    
+    return probeLeaves (trees.packed,trees.leafOffsets[slot],trees.leafOffsets[slot+1],&z,1,0) == 1;
 }
 
-bool lineUpTwo (unsigned int &x, unsigned int & y, unsigned int &z, tops &trees)
+// function returns the slot of branch x on the root, or notFound. Branches are sorted so this is a binary search.
+unsigned int findBranch (const adjacency & trees,unsigned int root,unsigned int x)
 {
-    unsigned int i= findBranch (trees[x],y); // finding where y is a branch on x
-    
-    return ((find (trees[x][i].second.begin(),trees[x][i].second.end(),z) != trees[x][i].second.end())); // returns true if it is found. That is, true if there is a lineup
+    idSpan children = getChildren (trees,root);
+    const unsigned int * it = lower_bound (children.begin(),children.end(),x);
     
+    if (it == children.end() || *it != x)
+    {
+        return notFound;
+    }
+    return (unsigned int) (it - trees.branches.data());
 }
 
-bool checkTwo (vector <unsigned int> &first, vector <unsigned int> &second, vector<unsigned int> &third, tops &trees)
+// procedure moves a coordinate onto the next leaf of the root. The branch slot follows along, skipping branches with no leaves.
+// Only call this when there is a next leaf.
+void nextLeaf (const adjacency & trees,pair <unsigned int, unsigned int> & coordinates)
 {
-    for (unsigned int i=0;i<9;i++)
+    coordinates.second++;
+    while (trees.leafOffsets[coordinates.first+1] <= coordinates.second)
     {
-        if (!lineUpTwo (first[i],second[i], third[i],trees))
-        {
-            return false;
-        }
+        coordinates.first++;
     }
-    return true;
-    
 }
 
-
-
-int main()
+// procedure sets a coordinate onto the given leaf of the root, counting leaves from zero. The slot is the last
+// branch whose leaves start at or before the leaf, which skips over branches with no leaves.
+void leafAt (const adjacency & trees,unsigned int root,unsigned int leaf,pair <unsigned int, unsigned int> & coordinates)
 {
+    const unsigned int * offsets = trees.leafOffsets.data();
+    unsigned int firstSlot = trees.branchOffsets[root];
+    unsigned int lastSlot = trees.branchOffsets[root+1];
     
-    map <unsigned int,string> reverseDictionary;
-    map <string,unsigned int>  dictionary;
-    tops trees;
-    vector <vector <unsigned int> > frameOneRootResults;
-    vector <vector <unsigned int> > frameTwoRootResults;
-    vector <vector <unsigned int> > frameThreeRootResults;
-    string inputWord;
-    
-    inputWord = "God"; // this will be input by the user
-    
-    load (trees,reverseDictionary,dictionary);
+    coordinates.second = offsets[firstSlot] + leaf;
+    coordinates.first = (unsigned int) (upper_bound (offsets + firstSlot,offsets + lastSlot + 1,coordinates.second) - offsets) - 1;
+}
 
+// procedure acts upon main and sweep coordinates directly, in order to find the next frame configuration.
+// Coordinates are (branch slot, leaf position) pairs into the index.
+void iterateCoordinates (const adjacency & trees,unsigned int root,pair <unsigned int, unsigned int> & mainCoordinates,pair <unsigned int, unsigned int> & sweepCoordinates)
+{
+    unsigned int lastLeaf = trees.leafOffsets[trees.branchOffsets[root+1]] - 1;
     
-    cout << "get the first panes" << endl;
-        getSquare (dictionary[inputWord],reverseDictionary,trees, frameOneRootResults);
+    if (sweepCoordinates.second == lastLeaf)
+    {
+        // then sweep is at end. Iterate main once and set sweep to main.
+        nextLeaf (trees,mainCoordinates);
+        sweepCoordinates = mainCoordinates;
+    }
+    else
+    {
+        nextLeaf (trees,sweepCoordinates);
+    }
+}
+
+// function hashes a word (FNV-1a). The loader hashes as it scans, this is for words that come from elsewhere.
+unsigned long long hashWord (string_view word)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0;i<word.size();i++)
+    {
+        hash = (hash ^ (unsigned char) word[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// procedure makes the table the given size, a power of two, and puts every id back in using the stored hashes
+void rehashDictionary (vocabulary & dictionary,size_t capacity)
+{
+    dictionary.slots.assign (capacity,notFound);
+    
+    for (unsigned int id = 0;id<dictionary.words.size();id++)
+    {
+        size_t slot = dictionary.hashes[id] & (capacity-1);
+        while (dictionary.slots[slot] != notFound)
+        {
+            slot = (slot+1) & (capacity-1);
+        }
+        dictionary.slots[slot] = id;
+    }
+}
+
+// procedure doubles the table
+void growDictionary (vocabulary & dictionary)
+{
+    rehashDictionary (dictionary,dictionary.slots.empty() ? 1024 : dictionary.slots.size() * 2);
+}
+
+// procedure builds the table afresh for the words as they stand, at the size interning them would have left it
+void rebuildDictionary (vocabulary & dictionary)
+{
+    size_t capacity = 1024;
+    while ((dictionary.words.size()+1) * 2 > capacity)
+    {
+        capacity *= 2;
+    }
+    rehashDictionary (dictionary,capacity);
+}
+
+// function returns the id of a word, giving it the next id if it is new
+unsigned int intern (vocabulary & dictionary,string_view word,unsigned long long hash)
+{
+    // keep the table at most half full
+    if ((dictionary.words.size()+1) * 2 > dictionary.slots.size())
+    {
+        growDictionary (dictionary);
+    }
+    
+    size_t mask = dictionary.slots.size()-1;
+    size_t slot = hash & mask;
+    while (dictionary.slots[slot] != notFound)
+    {
+        unsigned int id = dictionary.slots[slot];
+        if (dictionary.hashes[id] == hash && dictionary.words[id] == word)
+        {
+            return id;
+        }
+        slot = (slot+1) & mask;
+    }
+    
+    unsigned int id = (unsigned int) dictionary.words.size();
+    dictionary.words.push_back (word);
+    dictionary.hashes.push_back (hash);
+    dictionary.slots[slot] = id;
+    return id;
+}
+
+// function returns the id of a word, or notFound if the corpus never had it
+unsigned int lookUp (const vocabulary & dictionary,string_view word)
+{
+    if (dictionary.slots.empty())
+    {
+        return notFound;
+    }
+    
+    unsigned long long hash = hashWord (word);
+    size_t mask = dictionary.slots.size()-1;
+    size_t slot = hash & mask;
+    while (dictionary.slots[slot] != notFound)
+    {
+        unsigned int id = dictionary.slots[slot];
+        if (dictionary.hashes[id] == hash && dictionary.words[id] == word)
+        {
+            return id;
+        }
+        slot = (slot+1) & mask;
+    }
+    return notFound;
+}
+
+// function maps a file read only. An empty file gives back no data. Returns false if the file cannot be opened.
+bool mapFile (const char * name,mappedFile & file)
+{
+    file.data = 0;
+    file.size = 0;
+    
+    int fd = open (name,O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    
+    struct stat info;
+    if (fstat (fd,&info) != 0)
+    {
+        close (fd);
+        return false;
+    }
     
-    // Now to get the squares of the children of the given word
-     vector <unsigned int> children;
-    getChildren (trees[dictionary[inputWord]], children); // giving the full tree of the input word to get the children
+    if (info.st_size > 0)
+    {
+        void * data = mmap (0,(size_t) info.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (data == MAP_FAILED)
+        {
+            close (fd);
+            return false;
+        }
+        madvise (data,(size_t) info.st_size,MADV_SEQUENTIAL); // one pass, front to back
+        file.data = (const char *) data;
+        file.size = (size_t) info.st_size;
+    }
+    close (fd); // the mapping keeps the file alive
+    return true;
+}
+
+void unmapFile (mappedFile & file)
+{
+    if (file.data)
+    {
+        munmap ((void *) file.data,file.size);
+    }
+    file.data = 0;
+    file.size = 0;
+}
+
+// table of the bytes words are split on, the same ones fstream >> skips, built once at start up
+struct whitespaceTable
+{
+    bool bytes [256];
     
-    cout << "get the second panes" << endl;
-    // So now we get the squares for every child root
-    for (unsigned int bad = 0; bad< children.size();bad++)
+    whitespaceTable () : bytes ()
     {
-        getSquare (children[bad],reverseDictionary,trees, frameTwoRootResults);
+        for (unsigned char c : {' ','\t','\n','\v','\f','\r'})
+        {
+            bytes[c] = true;
+        }
     }
+};
+
+const whitespaceTable whitespace;
+
+// function returns true for the bytes words are split on
+inline bool isWhitespace (char c)
+{
+    return whitespace.bytes[(unsigned char) c];
+}
+
+// procedure tokenizes the mapped file in place in a single pass, from the given byte on. Words are split on whitespace
+// like fstream >> does, hashed as they are scanned, interned, and their ids appended to the stream.
+void tokenize (vocabulary & dictionary,intVector & stream,size_t from = 0)
+{
+    const char * at = dictionary.file.data + from;
+    const char * end = dictionary.file.data + dictionary.file.size;
     
-    // Here we get the grandchildren
-    vector<unsigned int> grandchildren;
+    while (at != end)
+    {
+        while (at != end && isWhitespace (*at))
+        {
+            at++;
+        }
+        if (at == end)
+        {
+            break;
+        }
+        
+        const char * start = at;
+        unsigned long long hash = 14695981039346656037ull; // same FNV-1a as hashWord
+        while (at != end && !isWhitespace (*at))
+        {
+            hash = (hash ^ (unsigned char) *at) * 1099511628211ull;
+            at++;
+        }
+        
+        stream.push_back (intern (dictionary,string_view (start,(size_t) (at-start)),hash));
+    }
+}
+
+// results go out through one big buffer straight to a file descriptor, and only hit write(2) when it fills.
+// Words come from the dictionary's id to word table, so rendering a stack is 27 array lookups.
+// In binary mode nothing is rendered: every stack is the 27 ids as raw native endian 32 bit values,
+// first pane a to i, then the second, then the third.
+// With transposes on, every stack is followed by its transpose, which the search never makes by itself.
+// A writer with a keep test only writes the stacks that pass it.
+struct resultWriter
+{
+    int fd;
+    bool binary;
+    bool transposes;
+    function <bool (const pane &,const pane &,const pane &)> keep; // empty keeps every stack
+    const vector <string_view> * words;
+    vector <char> buffer;
+    size_t used;
+    unsigned long long flushed; // bytes handed to the descriptor so far
+};
+
+// procedure sets a writer up on an open descriptor
+void openWriter (resultWriter & writer,int fd,bool binary,const vocabulary & dictionary)
+{
+    writer.fd = fd;
+    writer.binary = binary;
+    writer.transposes = false;
+    writer.words = &dictionary.words;
+    writer.buffer.resize (1 << 20);
+    writer.used = 0;
+    writer.flushed = 0;
+}
+
+// procedure empties the buffer into the descriptor, carrying on after short writes and interrupts
+void flushWriter (resultWriter & writer)
+{
+    traceSpan span ("write");
+    size_t done = 0;
+    while (done < writer.used)
+    {
+        ssize_t wrote = write (writer.fd,writer.buffer.data() + done,writer.used - done);
+        if (wrote < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "could not write results: " << strerror (errno) << endl;
+            break;
+        }
+        done += (size_t) wrote;
+    }
+    writer.flushed += done;
+    writer.used = 0;
+}
+
+void writeBytes (resultWriter & writer,const char * bytes,size_t size)
+{
+    if (writer.used + size > writer.buffer.size())
+    {
+        flushWriter (writer);
+        if (size > writer.buffer.size())
+        {
+            writer.buffer.resize (size);
+        }
+    }
+    memcpy (writer.buffer.data() + writer.used,bytes,size);
+    writer.used += size;
+}
+
+void writeWord (resultWriter & writer,unsigned int id)
+{
+    string_view word = (*writer.words)[id];
+    writeBytes (writer,word.data(),word.size());
+}
+
+// procedure writes one pane as three lines of " word word word"
+void writePane (resultWriter & writer,const pane & frame)
+{
+    for (unsigned int row = 0;row<3;row++)
+    {
+        for (unsigned int col = 0;col<3;col++)
+        {
+            writeBytes (writer," ",1);
+            writeWord (writer,frame[row*3+col]);
+        }
+        writeBytes (writer,"\n",1);
+    }
+}
+
+// function returns true if no word comes up twice among the given ones, at most 32 of them. Each word is probed
+// into a 64 slot table on the stack, so a repeat is found in its own short probe run without sorting anything.
+bool distinctWords (const unsigned int * words,unsigned int count)
+{
+    assert (count <= 32);
+    unsigned int table [64];
+    memset (table,0xff,sizeof (table)); // all ones is notFound, never a word
     
-    // Could use set union instead. I admit I made this as obtuse as possible
-    for (unsigned int temptempnum = 0; temptempnum < trees[dictionary[inputWord]].size();temptempnum++)
+    for (unsigned int w = 0;w<count;w++)
     {
-        //trees[dictionary[inputWord]][temptempnum].second; refers to a vector of grandchildren We need to union all of these
-        for (unsigned int temptempnumnum = 0;temptempnumnum < trees[dictionary[inputWord]][temptempnum].second.size();temptempnumnum++)
+        unsigned int slot = (words[w] * 2654435761u) >> 26;
+        while (table[slot] != notFound)
         {
-            // I know this is hideous. Search from beginning to end for the element. If it is not found, put it in.
-            if (!(find (grandchildren.begin(),grandchildren.end(),trees[dictionary[inputWord]][temptempnum].second[temptempnumnum]) != grandchildren.end()));
+            if (table[slot] == words[w])
             {
-                grandchildren.push_back (trees[dictionary[inputWord]][temptempnum].second[temptempnumnum]);
-                
+                return false;
             }
+            slot = (slot+1) & 63;
         }
+        table[slot] = words[w];
+    }
+    return true;
+}
+
+// applies filtering and outputs sloppily formatted data
+void outPutAll(const pane & frame, resultWriter & writer)
+{
+    // check to see if it is junk first
+    if (distinctWords (frame.data(),(unsigned int) frame.size()))
+    {
+        writeBytes (writer,"////////////////\n",17);
         
+        for (unsigned int row = 0;row<3;row++)
+        {
+            writeWord (writer,frame[row*3]);
+            writeBytes (writer," ",1);
+            writeWord (writer,frame[row*3+1]);
+            writeBytes (writer," ",1);
+            writeWord (writer,frame[row*3+2]);
+            writeBytes (writer,"\n",1);
+        }
+    }
+}
+
+// function returns the number of runs when main walks the leaves [mainBegin, mainEnd) of a root with the given
+// number of leaves. Every main leaf sweeps from itself to the last leaf.
+unsigned long long runsInRange (unsigned long long leaves,unsigned long long mainBegin,unsigned long long mainEnd)
+{
+    unsigned long long mains = mainEnd - mainBegin;
+    return mains * leaves - (mainBegin + mainEnd - 1) * mains / 2;
+}
+
+// function returns the number of runs on a given root. Saves lots of computing with math!
+unsigned long long maximum (const adjacency & trees,unsigned int root)
+{
+    unsigned long long grandchildren = grandchildCount (trees,root);
+    
+    return ((grandchildren * (grandchildren+1))/2);
+}
+
+// procedure places into the frame new values, based upon main and sweep coordinates gotten from iterateCoordinates
+void getNextFrame (unsigned int & current,const adjacency & trees,pane & frame,pair <unsigned int, unsigned int> & mainCoordinates,pair <unsigned int, unsigned int> & sweepCoordinates,bool & ranBefore)
+{
+    // This bool prevents missing the first one.
+    if (ranBefore)
+    {
+        iterateCoordinates (trees,current,mainCoordinates,sweepCoordinates);
+    }
+    
+    frame [0] = current; // a
+    frame [1] = trees.branches [mainCoordinates.first]; // b
+    frame [2] = leafValue (trees,mainCoordinates.second); // c
+    frame [3] = trees.branches [sweepCoordinates.first]; // d
+    frame [6] = leafValue (trees,sweepCoordinates.second); // g
+    
+    // for next time
+    ranBefore = true;
+    
+}
+
+// packs a (root, branch) pair so that sorting by the key sorts by root and then branch
+unsigned long long bigramKey (unsigned int x,unsigned int y)
+{
+    return ((unsigned long long) x << 32) | y;
+}
+
+// a (root, branch, leaf) triple as it is seen in the stream
+struct trigram
+{
+    unsigned int x;
+    unsigned int y;
+    unsigned int z;
+    
+    bool operator < (const trigram & other) const
+    {
+        if (x != other.x) return x < other.x;
+        if (y != other.y) return y < other.y;
+        return z < other.z;
+    }
+    bool operator == (const trigram & other) const
+    {
+        return x == other.x && y == other.y && z == other.z;
+    }
+};
+
+// procedure gathers the pairs and triples of neighbouring words in a stream of ids, sorted and without repeats
+void gatherGrams (const intVector & stream,vector <unsigned long long> & pairs,vector <trigram> & triples)
+{
+    if (stream.size() > 1)
+    {
+        pairs.reserve (stream.size()-1);
+    }
+    if (stream.size() > 2)
+    {
+        triples.reserve (stream.size()-2);
+    }
+    
+    for (size_t i = 0;i+1 < stream.size();i++)
+    {
+        pairs.push_back (bigramKey (stream[i],stream[i+1]));
+        if (i+2 < stream.size())
+        {
+            trigram t;
+            t.x = stream[i]; t.y = stream[i+1]; t.z = stream[i+2];
+            triples.push_back (t);
+        }
+    }
+    
+    sort (pairs.begin(),pairs.end());
+    pairs.erase (unique (pairs.begin(),pairs.end()),pairs.end());
+    sort (triples.begin(),triples.end());
+    triples.erase (unique (triples.begin(),triples.end()),triples.end());
+}
+
+// procedure lays the index out flat from sorted pairs and triples, replacing whatever it held
+void layOutIndex (const vector <unsigned long long> & pairs,const vector <trigram> & triples,unsigned int vocabularySize,adjacency & trees)
+{
+    // root to branch. Count the branches per root, then prefix sum into offsets.
+    trees.branchOffsets.assign (vocabularySize+1,0);
+    trees.branches.resize (pairs.size());
+    for (size_t i = 0;i<pairs.size();i++)
+    {
+        trees.branchOffsets[(pairs[i] >> 32) + 1]++;
+        trees.branches[i] = (unsigned int) pairs[i];
+    }
+    for (unsigned int r = 0;r<vocabularySize;r++)
+    {
+        trees.branchOffsets[r+1] += trees.branchOffsets[r];
+    }
+    
+    // branch to leaf. Triples come out in slot order, so the leaves can be appended as they are found.
+    trees.leafOffsets.assign (pairs.size()+1,0);
+    trees.leaves.resize (triples.size());
+    unsigned int slot = 0;
+    for (size_t i = 0;i<triples.size();i++)
+    {
+        unsigned long long key = bigramKey (triples[i].x,triples[i].y);
+        while (pairs[slot] != key)
+        {
+            slot++;
+        }
+        trees.leafOffsets[slot+1]++;
+        trees.leaves[i] = triples[i].z;
+    }
+    for (size_t s = 0;s<pairs.size();s++)
+    {
+        trees.leafOffsets[s+1] += trees.leafOffsets[s];
     }
     
-    cout << "get the third panes" <<endl;
-    // Finally we can get the grandchildren root results
-    for (unsigned int terrible = 0; terrible< grandchildren.size();terrible++)
+    // branch to root, inverted. Count the roots per branch, prefix sum, then deal the roots out in root order,
+    // which leaves every word's predecessors sorted.
+    trees.predecessorOffsets.assign (vocabularySize+1,0);
+    trees.predecessors.resize (pairs.size());
+    for (size_t i = 0;i<pairs.size();i++)
+    {
+        trees.predecessorOffsets[(unsigned int) pairs[i] + 1]++;
+    }
+    for (unsigned int w = 0;w<vocabularySize;w++)
+    {
+        trees.predecessorOffsets[w+1] += trees.predecessorOffsets[w];
+    }
+    intVector next (trees.predecessorOffsets.data(),trees.predecessorOffsets.data() + vocabularySize);
+    for (size_t i = 0;i<pairs.size();i++)
+    {
+        trees.predecessors[next[(unsigned int) pairs[i]]++] = (unsigned int) (pairs[i] >> 32);
+    }
+}
+
+// procedure builds the compressed index from the stream of word ids. Every pair of neighbouring words becomes a branch
+// and every run of three becomes a leaf. Pairs and triples are sorted and deduplicated once, then laid out flat.
+void buildIndex (const intVector & stream,unsigned int vocabularySize,adjacency & trees)
+{
+    vector <unsigned long long> pairs;
+    vector <trigram> triples;
+    gatherGrams (stream,pairs,triples);
+    layOutIndex (pairs,triples,vocabularySize,trees);
+}
+
+const unsigned long long emptyKey = ~0ull;
+const unsigned int trigramBits = 21; // widest id a packed trigram key can hold
+
+// function scrambles a packed key (the splitmix64 finalizer) so that neighbouring ids spread over the table
+unsigned long long mixKey (unsigned long long key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return key;
+}
+
+// packs a (root, branch, leaf) triple into one key. Only valid when every id is below 2^trigramBits.
+unsigned long long trigramKey (unsigned int x,unsigned int y,unsigned int z)
+{
+    return ((unsigned long long) x << (2*trigramBits)) | ((unsigned long long) y << trigramBits) | z;
+}
+
+// procedure sizes a set for count keys, keeping it between a third and two thirds full
+void initKeySet (keySet & set,size_t count)
+{
+    size_t capacity = 16;
+    while (capacity < count + count/2)
+    {
+        capacity *= 2;
+    }
+    set.slots.assign (capacity,emptyKey);
+    set.mask = capacity-1;
+}
+
+void insertKey (keySet & set,unsigned long long key)
+{
+    unsigned long long slot = mixKey (key) & set.mask;
+    while (set.slots[slot] != emptyKey && set.slots[slot] != key)
+    {
+        slot = (slot+1) & set.mask;
+    }
+    set.slots[slot] = key;
+}
+
+bool containsKey (const keySet & set,unsigned long long key)
+{
+    unsigned long long slot = mixKey (key) & set.mask;
+    while (set.slots[slot] != emptyKey)
+    {
+        if (set.slots[slot] == key)
+        {
+            return true;
+        }
+        slot = (slot+1) & set.mask;
+    }
+    return false;
+}
+
+// function gives the four bits a key sets in its word of the filter
+unsigned long long bloomBits (unsigned long long hash)
+{
+    return (1ull << ((hash >> 40) & 63)) | (1ull << ((hash >> 46) & 63)) | (1ull << ((hash >> 52) & 63)) | (1ull << ((hash >> 58) & 63));
+}
+
+// procedure sizes a filter at about ten bits per key
+void initBloom (bloomFilter & filter,size_t count)
+{
+    size_t words = 1;
+    while (words * 6 < count)
     {
-        //cout << terrible << "   " << grandchildren.size() <<endl;
-        getSquare (grandchildren[terrible],reverseDictionary,trees, frameThreeRootResults);
+        words *= 2;
     }
+    filter.words.assign (words,0);
+    filter.mask = words-1;
+}
+
+void insertBloom (bloomFilter & filter,unsigned long long key)
+{
+    unsigned long long hash = mixKey (key ^ 0x9e3779b97f4a7c15ull); // a different scramble from the tables
+    filter.words[hash & filter.mask] |= bloomBits (hash);
+}
+
+// function returns false only when the key is certainly absent
+bool mayContain (const bloomFilter & filter,unsigned long long key)
+{
+    unsigned long long hash = mixKey (key ^ 0x9e3779b97f4a7c15ull);
+    unsigned long long bits = bloomBits (hash);
+    return (filter.words[hash & filter.mask] & bits) == bits;
+}
 
-    cout << "stack the squares" <<endl;
-   // Now that we have all of the panes, we just have to do a shuffle of them. This will be a triple loop
+// procedure builds the membership sets from a finished index
+void buildMembership (adjacency & trees,bool withBloom)
+{
+    membership & members = trees.members;
+    unsigned int vocabularySize = (unsigned int) trees.branchOffsets.size() - 1;
+    
+    members.packedTrigrams = vocabularySize <= (1u << trigramBits);
+    members.filtered = withBloom;
+    
+    initKeySet (members.bigrams,trees.branches.size());
+    if (members.packedTrigrams)
+    {
+        initKeySet (members.trigrams,trees.leaves.size());
+    }
+    if (withBloom)
+    {
+        initBloom (members.bigramFilter,trees.branches.size());
+        initBloom (members.trigramFilter,members.packedTrigrams ? trees.leaves.size() : 0);
+    }
     
-    for (unsigned int a=0;a<frameOneRootResults.size();a++)
+    for (unsigned int x = 0;x<vocabularySize;x++)
     {
-        cout << a<< ": "<<frameOneRootResults.size() << endl;
-        for (unsigned int b=0;b<frameTwoRootResults.size();b++)
+        for (unsigned int slot = trees.branchOffsets[x];slot<trees.branchOffsets[x+1];slot++)
         {
-            if  (check (frameOneRootResults[a],frameTwoRootResults[b],trees)) // This will check to see if these squares stack. It seems to work, as you can assume that the branch in question is there after.
+            unsigned int y = trees.branches[slot];
+            insertKey (members.bigrams,bigramKey (x,y));
+            if (withBloom)
             {
-            for (unsigned int c=0;c<frameThreeRootResults.size();c++) //LOL
+                insertBloom (members.bigramFilter,bigramKey (x,y));
+            }
+            
+            for (unsigned int leaf = trees.leafOffsets[slot];members.packedTrigrams && leaf<trees.leafOffsets[slot+1];leaf++)
             {
-               if  (checkTwo (frameOneRootResults[a],frameTwoRootResults[b],frameThreeRootResults[c],trees)) // This seems to be giving a false positive
-               {
-                   // Check for repeats. This could be more efficient.
-                   bool junk;
-                   vector <unsigned int> test;
-                   
-                   for (unsigned int temp =0;temp<9;temp++)
-                   {
-                       test.push_back (frameOneRootResults[a][temp]);
-                       test.push_back (frameTwoRootResults[a][temp]);
-                       test.push_back (frameTwoRootResults[a][temp]);
-                   }
-                   sort (test.begin(),test.end());
-                
-                   vector<unsigned int>::iterator it;
-                   
-                   it = unique (test.begin(),test.end());
-                   
-                   test.resize( it - test.begin() );
-                   
-                   junk = (test.size() !=27);
-                   
-                   if (!junk)
-                   {
-                   cout << " "<<reverseDictionary[frameOneRootResults[a][0]];
-                   cout << " " << reverseDictionary[frameOneRootResults[a][1]];
-                   cout <<" " << reverseDictionary[frameOneRootResults[a][2]];
-                   cout <<endl;
-                   cout << " "<<reverseDictionary[frameOneRootResults[a][3]];
-                   cout << " "<<reverseDictionary[frameOneRootResults[a][4]];
-                   cout << " "<<reverseDictionary[frameOneRootResults[a][5]];
-                   cout <<endl;
-                   cout << " "<<reverseDictionary[frameOneRootResults[a][6]];
-                   cout << " "<<reverseDictionary[frameOneRootResults[a][7]];
-                   cout << " "<<reverseDictionary[frameOneRootResults[a][8]];
-                   cout <<endl;
-                   cout << " "<<reverseDictionary[frameTwoRootResults[b][0]];
-                   cout << " " << reverseDictionary[frameTwoRootResults[b][1]];
-                   cout <<" " << reverseDictionary[frameTwoRootResults[b][2]];
-                   cout <<endl;
-                   cout << " "<<reverseDictionary[frameTwoRootResults[b][3]];
-                   cout << " "<<reverseDictionary[frameTwoRootResults[b][4]];
-                   cout << " "<<reverseDictionary[frameTwoRootResults[b][5]];
-                   cout <<endl;
-                   cout << " "<<reverseDictionary[frameTwoRootResults[b][6]];
-                   cout << " "<<reverseDictionary[frameTwoRootResults[b][7]];
-                   cout << " "<<reverseDictionary[frameTwoRootResults[b][8]];
-                   cout <<endl;
-                   cout << " "<<reverseDictionary[frameThreeRootResults[c][0]];
-                   cout << " " << reverseDictionary[frameThreeRootResults[c][1]];
-                   cout <<" " << reverseDictionary[frameThreeRootResults[c][2]];
-                   cout <<endl;
-                   cout << " "<<reverseDictionary[frameThreeRootResults[c][3]];
-                   cout << " "<<reverseDictionary[frameThreeRootResults[c][4]];
-                   cout << " "<<reverseDictionary[frameThreeRootResults[c][5]];
-                   cout <<endl;
-                   cout << " "<<reverseDictionary[frameThreeRootResults[c][6]];
-                   cout << " "<<reverseDictionary[frameThreeRootResults[c][7]];
-                   cout << " "<<reverseDictionary[frameThreeRootResults[c][8]];
-                   cout <<endl<<endl;
-                   }
-                   
-                   
-                   
-               }
-            }
-            }
-        }
-    }
-    
-    cout << "search complete\n";
+                unsigned long long key = trigramKey (x,y,trees.leaves[leaf]);
+                insertKey (members.trigrams,key);
+                if (withBloom)
+                {
+                    insertBloom (members.trigramFilter,key);
+                }
+            }
+        }
+    }
+}
+
+// procedure packs the leaves of a finished index (see packedLeaves) and lets the plain array go. Runs only after
+// everything that is built from the plain leaves.
+void packLeaves (adjacency & trees)
+{
+    const flatArray <unsigned int> & leaves = trees.leaves;
+    unsigned int blocks = (unsigned int) ((leaves.size() + leafBlock - 1) / leafBlock);
+    vector <unsigned char> bytes;
+    bytes.reserve (leaves.size() * 2);
+    trees.packed.blockFirst.resize (blocks);
+    trees.packed.blockStart.resize (blocks);
+    
+    for (size_t leaf = 0;leaf<leaves.size();leaf++)
+    {
+        if (leaf % leafBlock == 0)
+        {
+            trees.packed.blockFirst[leaf / leafBlock] = leaves[leaf];
+            trees.packed.blockStart[leaf / leafBlock] = bytes.size();
+            continue;
+        }
+        unsigned int step = leaves[leaf] - leaves[leaf-1];
+        unsigned int zigzag = (step << 1) ^ (0u - (step >> 31));
+        while (zigzag >= 0x80)
+        {
+            bytes.push_back ((unsigned char) (zigzag | 0x80));
+            zigzag >>= 7;
+        }
+        bytes.push_back ((unsigned char) zigzag);
+    }
+    bytes.shrink_to_fit();
+    
+    cerr << "leaves packed from " << leaves.size() * sizeof (unsigned int) << " to " << bytes.size() + blocks * (sizeof (unsigned int) + sizeof (unsigned long long)) << " bytes" << endl;
+    trees.packed.bytes.take (bytes);
+    trees.leaves.view (0,0);
+    trees.compressed = true;
+}
+
+// procedure adds the words of the stream from the given place on to the dictionary's counts
+void countWords (vocabulary & dictionary,const intVector & stream,size_t from = 0)
+{
+    dictionary.counts.resize (dictionary.words.size(),0);
+    for (size_t i = from;i<stream.size();i++)
+    {
+        dictionary.counts[stream[i]]++;
+    }
+}
+
+// procedure renumbers the words most common first, keeping first seen order between words that come up as often.
+// It runs on the stream before the index is built, so the index comes out in the new ids with nothing to remap:
+// the busiest roots get the low ids, and their offsets, runs and dictionary entries sit together at the front.
+// Which of a pane and its transpose the search makes hangs on id order, so getSquareRange turns panes round to the
+// orientation first seen ids would give. Results are then the same stacks, found in a different order.
+void relabelByFrequency (vocabulary & dictionary,intVector & stream,intVector & order)
+{
+    unsigned int vocabularySize = (unsigned int) dictionary.words.size();
+    const vector <unsigned long long> & counts = dictionary.counts;
+    
+    order.resize (vocabularySize); // new id to old id
+    for (unsigned int id = 0;id<vocabularySize;id++)
+    {
+        order[id] = id;
+    }
+    stable_sort (order.begin(),order.end(),[&] (unsigned int x,unsigned int y) { return counts[x] > counts[y]; });
+    
+    intVector renumbered (vocabularySize); // old id to new id
+    vector <string_view> words (vocabularySize);
+    vector <unsigned long long> hashes (vocabularySize);
+    vector <unsigned long long> renumberedCounts (vocabularySize);
+    for (unsigned int id = 0;id<vocabularySize;id++)
+    {
+        renumbered[order[id]] = id;
+        words[id] = dictionary.words[order[id]];
+        hashes[id] = dictionary.hashes[order[id]];
+        renumberedCounts[id] = counts[order[id]];
+    }
+    for (size_t i = 0;i<stream.size();i++)
+    {
+        stream[i] = renumbered[stream[i]];
+    }
+    
+    dictionary.words.swap (words);
+    dictionary.hashes.swap (hashes);
+    dictionary.counts.swap (renumberedCounts);
+    dictionary.byFrequency = true;
+    rebuildDictionary (dictionary);
+}
+
+// how the index should be built, from the command line. A snapshot has to have been built the same way to be used.
+struct loadOptions
+{
+    bool withBloom = false; // --bloom
+    bool byFrequency = false; // --relabel
+    bool compress = false; // --compress
+};
+
+// prepares for the search phase. Includes creation of necessary data structures from stream, and population of dictionaries.
+// The input is mapped and read exactly once; the dictionary and the id stream come out of the same pass.
+bool load (adjacency & trees, vocabulary  &dictionary, const loadOptions & options, const string & inputName = "input.txt")
+{
+    traceSpan span ("load");
+    intVector stream; // the whole input as ids
+    
+    if (!mapFile (inputName.c_str(),dictionary.file))
+    {
+        cerr << "could not open " << inputName << endl;
+        return false;
+    }
+    
+    tokenize (dictionary,stream);
+    countWords (dictionary,stream);
+    dictionary.indexed = dictionary.file.size;
+    cerr << "dictionary loaded"<<endl;
+    intVector order;
+    if (options.byFrequency)
+    {
+        relabelByFrequency (dictionary,stream,order);
+    }
+    
+    buildIndex (stream,(unsigned int) dictionary.words.size(),trees);
+    trees.firstSeen.resize (order.size());
+    for (unsigned int id = 0;id<order.size();id++)
+    {
+        trees.firstSeen[id] = order[id];
+    }
+    buildMembership (trees,options.withBloom);
+    if (options.compress)
+    {
+        packLeaves (trees);
+    }
+    return true;
+}
+
+// procedure brings the index up to date with words added on to the end of the corpus since it was built, the bytes
+// from dictionary.indexed on. Only those are tokenized, starting two words back so the grams across the join are seen,
+// and new words get the next ids. Their pairs and triples are merged with the ones already in the index, which is then
+// laid out again; the triples that were not there before go to added, sorted. The corpus has to have grown at a word
+// boundary, which openSnapshot makes sure of.
+void appendCorpus (adjacency & trees,vocabulary & dictionary,const loadOptions & options,vector <trigram> & added)
+{
+    traceSpan span ("append");
+    const char * bytes = dictionary.file.data;
+    size_t start = dictionary.indexed;
+    size_t overlap = 0; // words gone back over, which were counted when they were indexed
+    for (unsigned int back = 0;back<2;back++)
+    {
+        while (start > 0 && isWhitespace (bytes[start-1]))
+        {
+            start--;
+        }
+        if (start > 0)
+        {
+            overlap++;
+        }
+        while (start > 0 && !isWhitespace (bytes[start-1]))
+        {
+            start--;
+        }
+    }
+    
+    unsigned int known = (unsigned int) dictionary.words.size();
+    intVector stream;
+    tokenize (dictionary,stream,start);
+    countWords (dictionary,stream,overlap);
+    dictionary.indexed = dictionary.file.size;
+    unsigned int vocabularySize = (unsigned int) dictionary.words.size();
+    
+    vector <unsigned long long> newPairs;
+    vector <trigram> newTriples;
+    gatherGrams (stream,newPairs,newTriples);
+    
+    // the grams already in the index, which come out of it sorted
+    vector <unsigned long long> pairs;
+    vector <trigram> triples;
+    {
+        const adjacency & old = trees;
+        intVector unpacked;
+        idSpan leaves = unpackLeaves (old,0,old.leafOffsets[old.leafOffsets.size()-1],unpacked);
+        pairs.reserve (old.branches.size());
+        triples.reserve (leaves.size());
+        for (unsigned int x = 0;x<known;x++)
+        {
+            for (unsigned int slot = old.branchOffsets[x];slot<old.branchOffsets[x+1];slot++)
+            {
+                unsigned int y = old.branches[slot];
+                pairs.push_back (bigramKey (x,y));
+                for (unsigned int leaf = old.leafOffsets[slot];leaf<old.leafOffsets[slot+1];leaf++)
+                {
+                    trigram t = {x,y,leaves[leaf]};
+                    triples.push_back (t);
+                }
+            }
+        }
+    }
+    
+    added.clear();
+    set_difference (newTriples.begin(),newTriples.end(),triples.begin(),triples.end(),back_inserter (added));
+    vector <unsigned long long> allPairs;
+    vector <trigram> allTriples;
+    allPairs.reserve (pairs.size() + newPairs.size());
+    allTriples.reserve (triples.size() + added.size());
+    set_union (pairs.begin(),pairs.end(),newPairs.begin(),newPairs.end(),back_inserter (allPairs));
+    set_union (triples.begin(),triples.end(),added.begin(),added.end(),back_inserter (allTriples));
+    vector <unsigned long long> ().swap (pairs);
+    vector <trigram> ().swap (triples);
+    
+    // words first seen now come after every word seen before, so they keep their ids in first seen order too
+    if (!trees.firstSeen.empty())
+    {
+        intVector firstSeen (trees.firstSeen.begin(),trees.firstSeen.end());
+        for (unsigned int id = known;id<vocabularySize;id++)
+        {
+            firstSeen.push_back (id);
+        }
+        trees.firstSeen.take (firstSeen);
+    }
+    
+    trees.compressed = false;
+    trees.packed.bytes.view (0,0);
+    trees.packed.blockFirst.view (0,0);
+    trees.packed.blockStart.view (0,0);
+    layOutIndex (allPairs,allTriples,vocabularySize,trees);
+    buildMembership (trees,options.withBloom);
+    if (options.compress)
+    {
+        packLeaves (trees);
+    }
+    cerr << "appended " << stream.size() << " words, " << vocabularySize - known << " of them new, and " << added.size() << " new trigrams" << endl;
+}
+
+// procedure marks the seeds whose stacks may read one of the added triples. Every triple a stack reads starts on its
+// first pane, or on the top row or left column of a later pane, so its first word is at most four steps on from the
+// seed (a to b to c to f to i is the furthest). Walking back four steps from the first word of every added triple
+// finds every such seed. The walk goes through the predecessors a step at a time, so it only reads the words it reaches.
+void touchedSeeds (const adjacency & trees,const vector <trigram> & added,vector <bool> & touched)
+{
+    unsigned int vocabularySize = (unsigned int) trees.branchOffsets.size() - 1;
+    touched.assign (vocabularySize,false);
+    intVector frontier;
+    for (size_t t = 0;t<added.size();t++)
+    {
+        if (!touched[added[t].x])
+        {
+            touched[added[t].x] = true;
+            frontier.push_back (added[t].x);
+        }
+    }
+    
+    intVector reached;
+    for (unsigned int step = 0;step<4 && !frontier.empty();step++)
+    {
+        reached.clear();
+        for (size_t f = 0;f<frontier.size();f++)
+        {
+            idSpan parents = getParents (trees,frontier[f]);
+            for (unsigned int p = 0;p<parents.size();p++)
+            {
+                if (!touched[parents[p]])
+                {
+                    touched[parents[p]] = true;
+                    reached.push_back (parents[p]);
+                }
+            }
+        }
+        frontier.swap (reached);
+    }
+}
+
+// The snapshot. Everything the search reads is written out once, each array at a 64 byte aligned offset, so a later
+// run maps the file and points the index straight at it: nothing is parsed or copied on a warm start.
+// The dictionary's word bytes are used in place too; only its small hash table of ids is rebuilt.
+// The header carries the corpus size and two checksums of input.txt. The quick one hashes a sample of blocks and is
+// always checked; the full one hashes every byte and is checked with --verify-snapshot. Either mismatch means stale,
+// except that a corpus that has only grown still matches on the part the snapshot covers, and is appended to.
+const char snapshotMagic [8] = {'F','O','L','D','S','N','A','P'};
+const unsigned int snapshotVersion = 5;
+
+enum snapshotSection
+{
+    branchOffsetsSection,
+    branchesSection,
+    leafOffsetsSection,
+    leavesSection,
+    bigramSlotsSection,
+    trigramSlotsSection,
+    bigramFilterSection,
+    trigramFilterSection,
+    wordOffsetsSection,
+    wordBytesSection,
+    wordHashesSection,
+    firstSeenSection,
+    packedBytesSection,
+    blockFirstSection,
+    blockStartSection,
+    predecessorOffsetsSection,
+    predecessorsSection,
+    wordCountsSection,
+    sectionCount
+};
+
+struct snapshotHeader
+{
+    char magic [8];
+    unsigned int version;
+    unsigned int sections;
+    unsigned long long corpusSize;
+    unsigned long long quickChecksum;
+    unsigned long long fullChecksum;
+    unsigned int vocabularySize;
+    unsigned int packedTrigrams;
+    unsigned int filtered;
+    unsigned int byFrequency;
+    unsigned int compressed;
+    unsigned long long bigramMask;
+    unsigned long long trigramMask;
+    unsigned long long bigramFilterMask;
+    unsigned long long trigramFilterMask;
+    unsigned long long offsets [sectionCount]; // from the start of the file
+    unsigned long long sizes [sectionCount]; // in bytes
+};
+
+// function hashes bytes (FNV-1a), carrying on from a previous hash
+unsigned long long hashBytes (const char * bytes,size_t size,unsigned long long hash)
+{
+    for (size_t i = 0;i<size;i++)
+    {
+        hash = (hash ^ (unsigned char) bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// function hashes 64 evenly spaced 4KB blocks of the corpus (all of it when it is small), plus its size
+unsigned long long quickChecksum (const mappedFile & corpus)
+{
+    const size_t block = 4096, samples = 64;
+    unsigned long long hash = hashBytes ((const char *) &corpus.size,sizeof (corpus.size),14695981039346656037ull);
+    
+    if (corpus.size <= block * samples)
+    {
+        return hashBytes (corpus.data,corpus.size,hash);
+    }
+    for (size_t i = 0;i<samples;i++)
+    {
+        size_t at = (corpus.size - block) / (samples-1) * i;
+        hash = hashBytes (corpus.data + at,block,hash);
+    }
+    return hash;
+}
+
+unsigned long long fullChecksum (const mappedFile & corpus)
+{
+    return hashBytes (corpus.data,corpus.size,14695981039346656037ull);
+}
+
+// procedure writes the dictionary and index of a finished load to a snapshot. It goes to a temporary name first and is
+// renamed into place, so a reader never sees half a snapshot.
+bool saveSnapshot (const string & name,const adjacency & trees,const vocabulary & dictionary)
+{
+    traceSpan span ("save snapshot");
+    const membership & members = trees.members;
+    
+    vector <unsigned long long> wordOffsets (dictionary.words.size()+1,0);
+    string wordBytes;
+    for (size_t id = 0;id<dictionary.words.size();id++)
+    {
+        wordBytes.append (dictionary.words[id].data(),dictionary.words[id].size());
+        wordOffsets[id+1] = wordBytes.size();
+    }
+    
+    const void * data [sectionCount];
+    size_t sizes [sectionCount];
+    data[branchOffsetsSection] = trees.branchOffsets.data(); sizes[branchOffsetsSection] = trees.branchOffsets.size() * sizeof (unsigned int);
+    data[branchesSection] = trees.branches.data(); sizes[branchesSection] = trees.branches.size() * sizeof (unsigned int);
+    data[leafOffsetsSection] = trees.leafOffsets.data(); sizes[leafOffsetsSection] = trees.leafOffsets.size() * sizeof (unsigned int);
+    data[leavesSection] = trees.leaves.data(); sizes[leavesSection] = trees.leaves.size() * sizeof (unsigned int);
+    data[bigramSlotsSection] = members.bigrams.slots.data(); sizes[bigramSlotsSection] = members.bigrams.slots.size() * sizeof (unsigned long long);
+    data[trigramSlotsSection] = members.trigrams.slots.data(); sizes[trigramSlotsSection] = members.trigrams.slots.size() * sizeof (unsigned long long);
+    data[bigramFilterSection] = members.bigramFilter.words.data(); sizes[bigramFilterSection] = members.bigramFilter.words.size() * sizeof (unsigned long long);
+    data[trigramFilterSection] = members.trigramFilter.words.data(); sizes[trigramFilterSection] = members.trigramFilter.words.size() * sizeof (unsigned long long);
+    data[wordOffsetsSection] = wordOffsets.data(); sizes[wordOffsetsSection] = wordOffsets.size() * sizeof (unsigned long long);
+    data[wordBytesSection] = wordBytes.data(); sizes[wordBytesSection] = wordBytes.size();
+    data[wordHashesSection] = dictionary.hashes.data(); sizes[wordHashesSection] = dictionary.hashes.size() * sizeof (unsigned long long);
+    data[wordCountsSection] = dictionary.counts.data(); sizes[wordCountsSection] = dictionary.counts.size() * sizeof (unsigned long long);
+    data[firstSeenSection] = trees.firstSeen.data(); sizes[firstSeenSection] = trees.firstSeen.size() * sizeof (unsigned int);
+    data[packedBytesSection] = trees.packed.bytes.data(); sizes[packedBytesSection] = trees.packed.bytes.size();
+    data[blockFirstSection] = trees.packed.blockFirst.data(); sizes[blockFirstSection] = trees.packed.blockFirst.size() * sizeof (unsigned int);
+    data[blockStartSection] = trees.packed.blockStart.data(); sizes[blockStartSection] = trees.packed.blockStart.size() * sizeof (unsigned long long);
+    data[predecessorOffsetsSection] = trees.predecessorOffsets.data(); sizes[predecessorOffsetsSection] = trees.predecessorOffsets.size() * sizeof (unsigned int);
+    data[predecessorsSection] = trees.predecessors.data(); sizes[predecessorsSection] = trees.predecessors.size() * sizeof (unsigned int);
+    
+    snapshotHeader header;
+    memset (&header,0,sizeof (header));
+    memcpy (header.magic,snapshotMagic,sizeof (snapshotMagic));
+    header.version = snapshotVersion;
+    header.sections = sectionCount;
+    header.corpusSize = dictionary.file.size;
+    header.quickChecksum = quickChecksum (dictionary.file);
+    header.fullChecksum = fullChecksum (dictionary.file);
+    header.vocabularySize = (unsigned int) dictionary.words.size();
+    header.packedTrigrams = members.packedTrigrams;
+    header.filtered = members.filtered;
+    header.byFrequency = dictionary.byFrequency;
+    header.compressed = trees.compressed;
+    header.bigramMask = members.bigrams.mask;
+    header.trigramMask = members.trigrams.mask;
+    header.bigramFilterMask = members.bigramFilter.mask;
+    header.trigramFilterMask = members.trigramFilter.mask;
+    
+    unsigned long long at = (sizeof (header) + 63) & ~63ull;
+    for (unsigned int section = 0;section<sectionCount;section++)
+    {
+        header.offsets[section] = at;
+        header.sizes[section] = sizes[section];
+        at = (at + sizes[section] + 63) & ~63ull;
+    }
+    
+    string temporary = name + ".partial";
+    FILE * out = fopen (temporary.c_str(),"wb");
+    if (!out)
+    {
+        return false;
+    }
+    
+    static const char zeros [64] = {0};
+    bool good = fwrite (&header,sizeof (header),1,out) == 1;
+    unsigned long long written = sizeof (header);
+    for (unsigned int section = 0;good && section<sectionCount;section++)
+    {
+        good = fwrite (zeros,1,header.offsets[section] - written,out) == header.offsets[section] - written;
+        good = good && (sizes[section] == 0 || fwrite (data[section],1,sizes[section],out) == sizes[section]);
+        written = header.offsets[section] + sizes[section];
+    }
+    good = (fclose (out) == 0) && good;
+    
+    if (!good || rename (temporary.c_str(),name.c_str()) != 0)
+    {
+        remove (temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// function gives back a section of a mapped snapshot as an array of T
+template <typename T>
+const T * sectionData (const mappedFile & snapshot,const snapshotHeader & header,unsigned int section)
+{
+    return (const T *) (snapshot.data + header.offsets[section]);
+}
+
+// function warm starts from a snapshot: maps it, checks it against input.txt, and points the index and the dictionary
+// into the mapping. Gives back false, with a reason, to make the caller load from scratch.
+bool openSnapshot (const string & name,adjacency & trees,vocabulary & dictionary,const loadOptions & options,bool verify)
+{
+    traceSpan span ("open snapshot");
+    mappedFile snapshot;
+    auto reject = [&] (const string & reason)
+    {
+        cerr << name << reason << endl;
+        unmapFile (snapshot);
+        unmapFile (dictionary.file);
+        return false;
+    };
+    
+    if (!mapFile (name.c_str(),snapshot) || snapshot.size < sizeof (snapshotHeader))
+    {
+        return reject (" is not there or is not a snapshot");
+    }
+    
+    snapshotHeader header;
+    memcpy (&header,snapshot.data,sizeof (header));
+    if (memcmp (header.magic,snapshotMagic,sizeof (snapshotMagic)) != 0 || header.version != snapshotVersion || header.sections != sectionCount)
+    {
+        return reject (" is not a snapshot of this version");
+    }
+    for (unsigned int section = 0;section<sectionCount;section++)
+    {
+        if (header.offsets[section] % 64 != 0 || header.offsets[section] + header.sizes[section] > snapshot.size)
+        {
+            return reject (" is cut short");
+        }
+    }
+    if (options.withBloom && !header.filtered)
+    {
+        return reject (" was built without Bloom filters");
+    }
+    if (options.byFrequency != (header.byFrequency != 0))
+    {
+        return reject (options.byFrequency ? " has ids in first seen order" : " has ids renumbered by frequency");
+    }
+    if (options.compress != (header.compressed != 0))
+    {
+        return reject (options.compress ? " has plain leaves" : " has packed leaves");
+    }
+    
+    if (!mapFile ("input.txt",dictionary.file))
+    {
+        return reject (": could not open input.txt");
+    }
+    mappedFile covered = dictionary.file;
+    covered.size = min ((size_t) header.corpusSize,covered.size);
+    if (header.corpusSize > dictionary.file.size || header.quickChecksum != quickChecksum (covered) || (verify && header.fullChecksum != fullChecksum (covered)))
+    {
+        return reject (" is stale, input.txt has changed");
+    }
+    if (covered.size > 0 && covered.size < dictionary.file.size && !isWhitespace (covered.data[covered.size-1]) && !isWhitespace (dictionary.file.data[covered.size]))
+    {
+        return reject (" is stale, input.txt has grown in the middle of a word");
+    }
+    
+    madvise ((void *) snapshot.data,snapshot.size,MADV_WILLNEED); // the search reads it all over, not front to back
+    
+    trees.branchOffsets.view (sectionData <unsigned int> (snapshot,header,branchOffsetsSection),header.sizes[branchOffsetsSection] / sizeof (unsigned int));
+    trees.branches.view (sectionData <unsigned int> (snapshot,header,branchesSection),header.sizes[branchesSection] / sizeof (unsigned int));
+    trees.leafOffsets.view (sectionData <unsigned int> (snapshot,header,leafOffsetsSection),header.sizes[leafOffsetsSection] / sizeof (unsigned int));
+    trees.leaves.view (sectionData <unsigned int> (snapshot,header,leavesSection),header.sizes[leavesSection] / sizeof (unsigned int));
+    trees.firstSeen.view (sectionData <unsigned int> (snapshot,header,firstSeenSection),header.sizes[firstSeenSection] / sizeof (unsigned int));
+    trees.packed.bytes.view (sectionData <unsigned char> (snapshot,header,packedBytesSection),header.sizes[packedBytesSection]);
+    trees.packed.blockFirst.view (sectionData <unsigned int> (snapshot,header,blockFirstSection),header.sizes[blockFirstSection] / sizeof (unsigned int));
+    trees.packed.blockStart.view (sectionData <unsigned long long> (snapshot,header,blockStartSection),header.sizes[blockStartSection] / sizeof (unsigned long long));
+    trees.predecessorOffsets.view (sectionData <unsigned int> (snapshot,header,predecessorOffsetsSection),header.sizes[predecessorOffsetsSection] / sizeof (unsigned int));
+    trees.predecessors.view (sectionData <unsigned int> (snapshot,header,predecessorsSection),header.sizes[predecessorsSection] / sizeof (unsigned int));
+    trees.compressed = header.compressed != 0;
+    
+    membership & members = trees.members;
+    members.packedTrigrams = header.packedTrigrams != 0;
+    members.filtered = options.withBloom; // a snapshot with filters still runs without them when they are not asked for
+    members.bigrams.slots.view (sectionData <unsigned long long> (snapshot,header,bigramSlotsSection),header.sizes[bigramSlotsSection] / sizeof (unsigned long long));
+    members.bigrams.mask = header.bigramMask;
+    members.trigrams.slots.view (sectionData <unsigned long long> (snapshot,header,trigramSlotsSection),header.sizes[trigramSlotsSection] / sizeof (unsigned long long));
+    members.trigrams.mask = header.trigramMask;
+    members.bigramFilter.words.view (sectionData <unsigned long long> (snapshot,header,bigramFilterSection),header.sizes[bigramFilterSection] / sizeof (unsigned long long));
+    members.bigramFilter.mask = header.bigramFilterMask;
+    members.trigramFilter.words.view (sectionData <unsigned long long> (snapshot,header,trigramFilterSection),header.sizes[trigramFilterSection] / sizeof (unsigned long long));
+    members.trigramFilter.mask = header.trigramFilterMask;
+    
+    // the words stay in the mapping; the table of ids is rebuilt from the stored hashes
+    const unsigned long long * wordOffsets = sectionData <unsigned long long> (snapshot,header,wordOffsetsSection);
+    const char * wordBytes = sectionData <char> (snapshot,header,wordBytesSection);
+    const unsigned long long * hashes = sectionData <unsigned long long> (snapshot,header,wordHashesSection);
+    const unsigned long long * counts = sectionData <unsigned long long> (snapshot,header,wordCountsSection);
+    dictionary.words.resize (header.vocabularySize);
+    dictionary.hashes.assign (hashes,hashes + header.vocabularySize);
+    dictionary.counts.assign (counts,counts + header.vocabularySize);
+    for (unsigned int id = 0;id<header.vocabularySize;id++)
+    {
+        dictionary.words[id] = string_view (wordBytes + wordOffsets[id],(size_t) (wordOffsets[id+1] - wordOffsets[id]));
+    }
+    dictionary.byFrequency = header.byFrequency != 0;
+    dictionary.indexed = covered.size;
+    rebuildDictionary (dictionary);
+    return true;
+}
+
+// A pane cursor: the search of one root, held as plain state so it can be stopped after any pane and carried on
+// later. The coordinates say which (b, c, d, g) frame it is on; each of the E, H, F and I levels holds its
+// candidates and the next one to take. A consumer pulls panes one at a time with nextPane and may stop whenever
+// it likes; nothing past the pane it asked for is ever searched.
+// Sweep never comes before main, so of a pane and its transpose (b and d, c and g, f and h swapped) only the one
+// whose b, c leaf comes first is made, and no pane is found twice. That makes a stack's first pane canonical and
+// nothing more: its second and third panes may lie either way round, so the join takes every pane it probes both
+// ways (see gatherOriented).
+// A cursor may be constrained: given a sorted set of allowed words for each cell, frames with a disallowed b, c, d
+// or g are skipped and every level's candidates are cut down to its cell's set before going deeper. Cell a is the
+// root, so its set is the caller's to keep to.
+// No pane with a word twice can be part of a stack, so the cursor never makes one: a frame whose a, b, c, d and g are
+// not all different is skipped, and each level drops the candidates already used in the cells filled before it.
+struct paneCursor
+{
+    const idSpan * allowed; // nine sets, one per cell, or null for none
+    unsigned int root;
+    unsigned int mainBegin;
+    unsigned int mainEnd;
+    pair <unsigned int, unsigned int> mainCoordinates;
+    pair <unsigned int, unsigned int> sweepCoordinates;
+    unsigned long long pos; // frames started
+    unsigned long long max; // frames in the range
+    bool ranBefore;
+    pane frame;
+    
+    intVector intersectForE;
+    intVector intersectForH;
+    intVector intersectForF;
+    intVector intersectForI;
+    intVector unconstrained; // a level's candidates before they are cut down to the allowed set
+    intVector leavesX, leavesY; // packed leaves decoded for a level
+    unsigned int sizeE, sizeH, sizeF, sizeI;
+    unsigned int iterE, iterH, iterF, iterI; // the next candidate of each level
+};
+
+// where a cursor is, in a few numbers. Enough to rebuild the cursor on the same index, in this run or a later one.
+struct paneCursorState
+{
+    unsigned int root;
+    unsigned int mainBegin;
+    unsigned int mainEnd;
+    unsigned int mainLeaf; // counting the root's leaves from zero
+    unsigned int sweepLeaf;
+    unsigned long long pos;
+    unsigned int iterE, iterH, iterF, iterI;
+};
+
+// procedure sets a cursor to the start of the main leaves [mainBegin, mainEnd) of a root
+void openCursor (const adjacency & trees,unsigned int root,unsigned int mainBegin,unsigned int mainEnd,paneCursor & cursor,const idSpan * allowed = 0)
+{
+    cursor.allowed = allowed;
+    cursor.root = root;
+    cursor.mainBegin = mainBegin;
+    cursor.mainEnd = mainEnd;
+    cursor.pos = 0;
+    cursor.max = 0;
+    cursor.ranBefore = false;
+    cursor.frame.fill (1234578);
+    cursor.sizeE = cursor.sizeH = cursor.sizeF = cursor.sizeI = 0;
+    cursor.iterE = cursor.iterH = cursor.iterF = cursor.iterI = 0;
+    
+    if (mainBegin >= mainEnd)
+    {
+        return;
+    }
+    leafAt (trees,root,mainBegin,cursor.mainCoordinates);
+    cursor.sweepCoordinates = cursor.mainCoordinates;
+    cursor.max = runsInRange (grandchildCount (trees,root),mainBegin,mainEnd);
+}
+
+// the order the cells are filled in: a, b, c, d and g by the frame, then e, h, f and i by the four levels
+const unsigned int fillOrder [9] = {0,1,2,3,6,4,7,5,8};
+
+// function returns true if the word may go in the cell
+bool allowedIn (const paneCursor & cursor,unsigned int cell,unsigned int word)
+{
+    return !cursor.allowed || binary_search (cursor.allowed[cell].begin(),cursor.allowed[cell].end(),word);
+}
+
+// function returns true if the main half of the frame can start a pane: a, b and c all different, b and c allowed
+bool mainUsable (const paneCursor & cursor)
+{
+    const pane & frame = cursor.frame;
+    return frame[1] != frame[0] && frame[2] != frame[0] && frame[2] != frame[1] && allowedIn (cursor,1,frame[1]) && allowedIn (cursor,2,frame[2]);
+}
+
+// function returns true if the sweep half can go with the main half: d and g different from each other and a, b, c
+bool sweepUsable (const paneCursor & cursor)
+{
+    const pane & frame = cursor.frame;
+    for (unsigned int k = 0;k<3;k++)
+    {
+        if (frame[3] == frame[k] || frame[6] == frame[k])
+        {
+            return false;
+        }
+    }
+    return frame[3] != frame[6] && allowedIn (cursor,3,frame[3]) && allowedIn (cursor,6,frame[6]);
+}
+
+// function intersects two runs into the candidates for the next cell in fill order, the one after the first filled
+// cells. On a constrained cursor they are cut down to the cell's allowed set too. Words already in the frame are dropped.
+unsigned int levelCandidates (paneCursor & cursor,unsigned int filled,idSpan x,idSpan y,intVector & candidates)
+{
+    unsigned int size;
+    if (!cursor.allowed)
+    {
+        size = getIntersection (x,y,candidates);
+    }
+    else
+    {
+        // the allowed set is usually the shortest, so it goes in first
+        unsigned int narrowedSize = getIntersection (cursor.allowed[fillOrder[filled]],x,cursor.unconstrained);
+        idSpan narrowed = {cursor.unconstrained.data(),cursor.unconstrained.data() + narrowedSize};
+        size = getIntersection (narrowed,y,candidates);
+    }
+    
+    unsigned int kept = 0;
+    for (unsigned int c = 0;c<size;c++)
+    {
+        unsigned int word = candidates[c];
+        bool used = false;
+        for (unsigned int k = 0;k<filled;k++)
+        {
+            used |= cursor.frame[fillOrder[k]] == word;
+        }
+        candidates[kept] = word;
+        kept += !used;
+    }
+    return kept;
+}
+
+// procedures fill the candidates of one level from the frame as it stands, and empty every level below it
+
+void candidatesForE (const adjacency & trees,paneCursor & cursor)
+{
+    idSpan childrenOfB = getChildren (trees,cursor.frame[1]); // gets the children of root B.
+    idSpan childrenOfD = getChildren (trees,cursor.frame[3]); // gets the children of root D.
+    cursor.sizeE = levelCandidates (cursor,5,childrenOfB,childrenOfD,cursor.intersectForE);
+    cursor.iterE = 0;
+    cursor.sizeH = cursor.sizeF = cursor.sizeI = 0;
+    cursor.iterH = cursor.iterF = cursor.iterI = 0;
+}
+
+void candidatesForH (const adjacency & trees,paneCursor & cursor)
+{
+    // we need the children of G
+    idSpan childrenOfG = getChildren (trees,cursor.frame[6]);
+    // we also need the BE children
+    idSpan childrenOfBE = leafRun (trees,findBranch (trees,cursor.frame[1],cursor.frame[4]),&childrenOfG,cursor.leavesX);
+    cursor.sizeH = levelCandidates (cursor,6,childrenOfBE,childrenOfG,cursor.intersectForH);
+    cursor.iterH = 0;
+    cursor.sizeF = cursor.sizeI = 0;
+    cursor.iterF = cursor.iterI = 0;
+}
+
+void candidatesForF (const adjacency & trees,paneCursor & cursor)
+{
+    // we need the children of C
+    idSpan childrenOfC = getChildren (trees,cursor.frame[2]);
+    // now we need the de children.
+    idSpan childrenOfDE = leafRun (trees,findBranch (trees,cursor.frame[3],cursor.frame[4]),&childrenOfC,cursor.leavesX);
+    cursor.sizeF = levelCandidates (cursor,7,childrenOfDE,childrenOfC,cursor.intersectForF);
+    cursor.iterF = 0;
+    cursor.sizeI = 0;
+    cursor.iterI = 0;
+}
+
+void candidatesForI (const adjacency & trees,paneCursor & cursor)
+{
+    // we need the cf and the gh children. When they are packed the shorter is decoded and the longer probed with it.
+    unsigned int slotCF = findBranch (trees,cursor.frame[2],cursor.frame[5]);
+    unsigned int slotGH = findBranch (trees,cursor.frame[6],cursor.frame[7]);
+    bool shorterCF = trees.leafOffsets[slotCF+1] - trees.leafOffsets[slotCF] <= trees.leafOffsets[slotGH+1] - trees.leafOffsets[slotGH];
+    idSpan shorter = leafRun (trees,shorterCF ? slotCF : slotGH,0,cursor.leavesX);
+    idSpan longer = leafRun (trees,shorterCF ? slotGH : slotCF,&shorter,cursor.leavesY);
+    idSpan childrenOfCF = shorterCF ? shorter : longer;
+    idSpan childrenOfGH = shorterCF ? longer : shorter;
+    cursor.sizeI = levelCandidates (cursor,8,childrenOfCF,childrenOfGH,cursor.intersectForI);
+    cursor.iterI = 0;
+}
+
+// function moves the cursor on to its next pane and copies it out. Gives back false once the range is done.
+// The deepest level that still has candidates is always taken from first, which walks the panes in the same
+// order as the nested E, H, F, I loops would.
+bool nextPane (const adjacency & trees,paneCursor & cursor,pane & out)
+{
+    for (;;)
+    {
+        if (cursor.iterI < cursor.sizeI)
+        {
+            cursor.frame[8] = cursor.intersectForI[cursor.iterI++];
+            out = cursor.frame;
+            return true;
+        }
+        if (cursor.iterF < cursor.sizeF)
+        {
+            cursor.frame[5] = cursor.intersectForF[cursor.iterF++]; // assign F, then go on to get possible I values
+            candidatesForI (trees,cursor);
+            continue;
+        }
+        if (cursor.iterH < cursor.sizeH)
+        {
+            cursor.frame[7] = cursor.intersectForH[cursor.iterH++]; // assign H, then go on to get possible F values
+            candidatesForF (trees,cursor);
+            continue;
+        }
+        if (cursor.iterE < cursor.sizeE)
+        {
+            cursor.frame[4] = cursor.intersectForE[cursor.iterE++];
+            candidatesForH (trees,cursor);
+            continue;
+        }
+        if (cursor.pos == cursor.max)
+        {
+            return false;
+        }
+        getNextFrame (cursor.root,trees,cursor.frame,cursor.mainCoordinates,cursor.sweepCoordinates,cursor.ranBefore);
+        cursor.pos++;
+        
+        if (!mainUsable (cursor))
+        {
+            // main fixes a, b and c, so the rest of this main's sweep goes unvisited
+            unsigned int lastLeaf = grandchildCount (trees,cursor.root) - 1;
+            unsigned int firstLeaf = trees.leafOffsets[trees.branchOffsets[cursor.root]];
+            cursor.pos += lastLeaf - (cursor.sweepCoordinates.second - firstLeaf);
+            leafAt (trees,cursor.root,lastLeaf,cursor.sweepCoordinates);
+            cursor.sizeE = 0;
+            cursor.iterE = 0;
+            continue;
+        }
+        if (!sweepUsable (cursor))
+        {
+            cursor.sizeE = 0;
+            cursor.iterE = 0;
+            continue;
+        }
+        candidatesForE (trees,cursor);
+    }
+}
+
+// procedure takes down where a cursor is
+void saveCursor (const adjacency & trees,const paneCursor & cursor,paneCursorState & state)
+{
+    unsigned int firstLeaf = trees.leafOffsets[trees.branchOffsets[cursor.root]];
+    
+    state.root = cursor.root;
+    state.mainBegin = cursor.mainBegin;
+    state.mainEnd = cursor.mainEnd;
+    state.mainLeaf = cursor.pos ? cursor.mainCoordinates.second - firstLeaf : cursor.mainBegin;
+    state.sweepLeaf = cursor.pos ? cursor.sweepCoordinates.second - firstLeaf : cursor.mainBegin;
+    state.pos = cursor.pos;
+    state.iterE = cursor.iterE;
+    state.iterH = cursor.iterH;
+    state.iterF = cursor.iterF;
+    state.iterI = cursor.iterI;
+}
+
+// procedure rebuilds a cursor from a saved state. The frame is put back from its coordinates, and each level is
+// searched again only down as far as the cursor had got, so it costs at most four intersections.
+// A constrained cursor must be rebuilt with the same allowed sets.
+void restoreCursor (const adjacency & trees,const paneCursorState & state,paneCursor & cursor,const idSpan * allowed = 0)
+{
+    openCursor (trees,state.root,state.mainBegin,state.mainEnd,cursor,allowed);
+    if (state.pos == 0)
+    {
+        return;
+    }
+    
+    leafAt (trees,state.root,state.mainLeaf,cursor.mainCoordinates);
+    leafAt (trees,state.root,state.sweepLeaf,cursor.sweepCoordinates);
+    cursor.ranBefore = false;
+    getNextFrame (cursor.root,trees,cursor.frame,cursor.mainCoordinates,cursor.sweepCoordinates,cursor.ranBefore);
+    cursor.pos = state.pos;
+    
+    if (!mainUsable (cursor) || !sweepUsable (cursor))
+    {
+        return; // the cursor had skipped this frame
+    }
+    candidatesForE (trees,cursor);
+    cursor.iterE = state.iterE;
+    if (state.iterE == 0)
+    {
+        return;
+    }
+    cursor.frame[4] = cursor.intersectForE[state.iterE-1];
+    candidatesForH (trees,cursor);
+    cursor.iterH = state.iterH;
+    if (state.iterH == 0)
+    {
+        return;
+    }
+    cursor.frame[7] = cursor.intersectForH[state.iterH-1];
+    candidatesForF (trees,cursor);
+    cursor.iterF = state.iterF;
+    if (state.iterF == 0)
+    {
+        return;
+    }
+    cursor.frame[5] = cursor.intersectForF[state.iterF-1];
+    candidatesForI (trees,cursor);
+    cursor.iterI = state.iterI;
+}
+
+// function returns true if the pane is the orientation the search makes in first seen ids, (b, c) before (d, g).
+// Always true when ids were never renumbered.
+bool firstSeenCanonical (const adjacency & trees,const pane & frame)
+{
+    if (trees.firstSeen.empty())
+    {
+        return true;
+    }
+    unsigned int b = trees.firstSeen[frame[1]], d = trees.firstSeen[frame[3]];
+    if (b != d)
+    {
+        return b < d;
+    }
+    return trees.firstSeen[frame[2]] < trees.firstSeen[frame[6]];
+}
+
+// A search's scratch is its cursor: the cursor's buffers, one set per level, are all the search writes to besides the
+// results. Each thread passes the same cursor to every range it searches, so the buffers are grown once, to the
+// longest runs met, and the search loops allocate nothing after that. Debug builds check that they have not started to.
+const unsigned int cursorBuffers = 7; // the four levels, the constrained scratch and the two decoded leaf runs
+const unsigned int mostGrowths = 32; // each buffer at least doubles, and no run is longer than 2^32
+
+// procedure finds every square of the root whose main coordinate is one of the leaves [mainBegin, mainEnd).
+// Splitting a root on main leaves is what lets one heavy root be shared out between threads.
+// If drain is given, it is handed the results and they are cleared every time drainEvery panes have built up,
+// which is how panes stream out of a search that is still running. Given a saved cursor, the range carries on from it.
+void getSquareRange (unsigned int current, const adjacency & trees, unsigned int mainBegin, unsigned int mainEnd, paneStore & rootResults, paneCursor & cursor, const function <void (paneStore &)> * drain = 0, size_t drainEvery = 0, const paneCursorState * from = 0)
+{
+    unsigned long long started = microsecondsNow();
+    unsigned long long grown = metricsHere().buffersGrown;
+    if (from)
+    {
+        restoreCursor (trees,*from,cursor);
+    }
+    else
+    {
+        openCursor (trees,current,mainBegin,mainEnd,cursor);
+    }
+    
+    pane frame;
+    unsigned long long panes = 0;
+    while (nextPane (trees,cursor,frame))
+    {
+        //outPutAll (frame,writer); // This is for stopping at the squares for a simple readout
+        
+        if (!firstSeenCanonical (trees,frame))
+        {
+            frame = transposePane (frame);
+        }
+        rootResults.push(frame);
+        panes++;
+        if (drain && rootResults.size() >= drainEvery)
+        {
+            (*drain) (rootResults);
+            rootResults.clear();
+        }
+    }
+    threadMetrics & counts = metricsHere();
+    assert (counts.buffersGrown - grown <= cursorBuffers * mostGrowths); // a buffer that grows every frame is an allocation in the loop
+    (void) grown;
+    counts.panes += panes;
+    rootRecord record = {current,panes,microsecondsNow() - started};
+    counts.roots.push_back (record);
+}
+
+// procedure finds every square of the root
+void getSquare (unsigned int current, const adjacency & trees, paneStore & rootResults)
+{
+    paneCursor cursor;
+    getSquareRange (current,trees,0,grandchildCount (trees,current),rootResults,cursor);
+}
+
+// procedure runs a fixed batch of tasks on a work stealing pool. Each worker starts with every threads-th task in
+// its own deque and takes from the back of it; when that runs dry it steals from the front of the others.
+// Tasks never make new tasks, so a worker that finds every deque empty is finished.
+// Given estimated costs, tasks are dealt out dearest first and each deque is held dearest first, and a worker takes
+// from the front of its own as well: every worker starts on the dearest work it has (longest processing time first)
+// and thieves, who take from the front too, get the dearest left.
+void runTasks (unsigned int taskCount, unsigned int threads, const function <void (unsigned int, unsigned int)> & work, const vector <unsigned long long> * costs = 0)
+{
+    intVector order (taskCount);
+    for (unsigned int task = 0;task<taskCount;task++)
+    {
+        order[task] = task;
+    }
+    if (costs)
+    {
+        stable_sort (order.begin(),order.end(),[&] (unsigned int x,unsigned int y) { return (*costs)[x] > (*costs)[y]; });
+    }
+    
+    if (threads <= 1 || taskCount <= 1)
+    {
+        for (unsigned int task = 0;task<taskCount;task++)
+        {
+            work (0,order[task]);
+        }
+        return;
+    }
+    
+    vector <deque <unsigned int> > queues (threads);
+    vector <mutex> locks (threads);
+    for (unsigned int task = 0;task<taskCount;task++)
+    {
+        queues[task % threads].push_back (order[task]);
+    }
+    
+    vector <thread> workers;
+    for (unsigned int worker = 0;worker<threads;worker++)
+    {
+        workers.push_back (thread ([&,worker] ()
+        {
+            while (true)
+            {
+                unsigned int task = notFound;
+                
+                // own work first, newest end, or the dearest end given costs
+                {
+                    lock_guard <mutex> hold (locks[worker]);
+                    if (!queues[worker].empty() && costs)
+                    {
+                        task = queues[worker].front();
+                        queues[worker].pop_front();
+                    }
+                    else if (!queues[worker].empty())
+                    {
+                        task = queues[worker].back();
+                        queues[worker].pop_back();
+                    }
+                }
+                // then steal, oldest end, which given costs is the dearest
+                for (unsigned int other = 1;task == notFound && other<threads;other++)
+                {
+                    unsigned int victim = (worker + other) % threads;
+                    lock_guard <mutex> hold (locks[victim]);
+                    if (!queues[victim].empty())
+                    {
+                        task = queues[victim].front();
+                        queues[victim].pop_front();
+                    }
+                }
+                if (task == notFound)
+                {
+                    return;
+                }
+                work (worker,task);
+            }
+        }));
+    }
+    for (unsigned int worker = 0;worker<threads;worker++)
+    {
+        workers[worker].join();
+    }
+}
+
+// one piece of pane search: the main leaves [mainBegin, mainEnd) of a root, with the layer its panes belong to
+struct squareTask
+{
+    unsigned int layer;
+    unsigned int root;
+    unsigned int mainBegin;
+    unsigned int mainEnd;
+    unsigned long long cost; // estimated, see mainCosts
+};
+
+// The cost model. maximum() counts a root's frames, but frames are far from equal: each one intersects the children
+// of its b and of its d, and the levels under E grow with what that finds. So a frame is costed as frameCost plus
+// the two child counts. Main leaf m of a root with L leaves sweeps L - m frames, all with its own b, and one with
+// the d of each leaf from m on, which a running sum from the back gives for every m in one pass.
+const unsigned long long frameCost = 8; // the fixed work of a frame, in ids read by an intersection
+
+// procedure gives the estimated cost of each main leaf of a root
+void mainCosts (const adjacency & trees,unsigned int root,vector <unsigned long long> & costs)
+{
+    unsigned int leaves = grandchildCount (trees,root);
+    unsigned int firstLeaf = trees.leafOffsets[trees.branchOffsets[root]];
+    costs.resize (leaves);
+    
+    unsigned long long sweeps = 0; // the child counts of every d from m on
+    for (unsigned int slot = trees.branchOffsets[root+1];slot-- > trees.branchOffsets[root];)
+    {
+        unsigned int b = trees.branches[slot];
+        unsigned long long children = trees.branchOffsets[b+1] - trees.branchOffsets[b];
+        for (unsigned int leaf = trees.leafOffsets[slot+1];leaf-- > trees.leafOffsets[slot];)
+        {
+            unsigned int m = leaf - firstLeaf;
+            sweeps += children;
+            costs[m] = (leaves - m) * (frameCost + children) + sweeps;
+        }
+    }
+}
+
+// function returns the estimated cost of searching a whole root
+unsigned long long rootCost (const adjacency & trees,unsigned int root)
+{
+    vector <unsigned long long> costs;
+    mainCosts (trees,root,costs);
+    unsigned long long total = 0;
+    for (size_t m = 0;m<costs.size();m++)
+    {
+        total += costs[m];
+    }
+    return total;
+}
+
+// procedure cuts a root into tasks of about grain cost each. Early main leaves sweep further than late ones, and
+// leaves under busy branches cost more, so the cuts are made on accumulated cost rather than on leaf counts.
+// A heavy root comes out as many tasks, which the threads share.
+void splitRoot (const adjacency & trees,unsigned int layer,unsigned int root,unsigned long long grain,vector <squareTask> & tasks)
+{
+    vector <unsigned long long> costs;
+    mainCosts (trees,root,costs);
+    squareTask task;
+    task.layer = layer;
+    task.root = root;
+    task.mainBegin = 0;
+    task.cost = 0;
+    
+    for (unsigned int m = 0;m<costs.size();m++)
+    {
+        task.cost += costs[m];
+        if (task.cost >= grain || m+1 == costs.size())
+        {
+            task.mainEnd = m+1;
+            tasks.push_back (task);
+            task.mainBegin = m+1;
+            task.cost = 0;
+        }
+    }
+}
+
+// Checkpoints, for folds long enough to be killed part way. The run keeps a journal: a header naming the run, then
+// records, each carrying its own checksum. A search record holds the panes a task found since its last record and
+// where its cursor had got, so a task in flight is logged every checkpointPanes panes and a finished one once more at
+// its end. A stacking record holds how many first panes are stacked and how long the output file was then.
+// Workers only copy a record into a queue. A thread of its own wakes every --checkpoint-every seconds, writes what has
+// queued since as one batch and syncs the journal once. A batch with a stacking record syncs the output first, so a
+// record never claims output that is not on disk; the search writes no output, so its batches skip that sync.
+// A run stopped part way loses at most the last interval's work.
+// --resume reads the journal back up to its last whole record, truncates the output to the length that record gives,
+// and carries on: finished tasks are not searched again, tasks in flight restart from their cursors, and stacking
+// restarts after the last first pane it logged. Results are the same as a run that was never stopped.
+// Tasks are cut the same whatever the thread count when checkpointing, so a run can resume on another machine.
+const char checkpointMagic [8] = {'F','O','L','D','C','K','P','T'};
+const unsigned int checkpointVersion = 1;
+const size_t checkpointPanes = 1 << 16; // a task in flight is logged every this many panes
+const unsigned int checkpointTasks = 4096; // the tasks a checkpointed search is cut into, about
+
+struct checkpointHeader
+{
+    char magic [8];
+    unsigned int version;
+    unsigned int seed;
+    unsigned long long corpusChecksum; // quickChecksum of input.txt
+    unsigned long long planChecksum; // of the task list
+    unsigned int tasks;
+    unsigned int output; // what the output bytes hang on: binary, transposes, delta, renumbered ids
+};
+
+enum checkpointRecord
+{
+    searchedRecord = 1,
+    stackedRecord = 2
+};
+
+// what the journal held, on resume
+struct checkpointState
+{
+    vector <vector <pane> > panes; // per task, every pane logged
+    vector <paneCursorState> cursors; // per task, where its search had got
+    vector <bool> started;
+    vector <bool> finished;
+    unsigned long long stacked = 0; // first panes stacked
+    unsigned long long outputBytes = 0;
+};
+
+struct checkpointLog
+{
+    int fd = -1;
+    int outputFd = -1;
+    double every = 60; // seconds between batches, and between stacking records. Zero syncs every record.
+    chrono::steady_clock::time_point lastStacked;
+    checkpointState resumed;
+    
+    mutex lock;
+    condition_variable wake;
+    deque <vector <char> > pending;
+    bool pendingStacked = false; // a stacking record is queued, so the output needs syncing before the batch
+    bool closing = false;
+    thread writer;
+};
+
+// function returns a checksum of the task list, which the journal is only good for
+unsigned long long planChecksum (const vector <squareTask> & tasks)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t t = 0;t<tasks.size();t++)
+    {
+        unsigned int fields [4] = {tasks[t].layer,tasks[t].root,tasks[t].mainBegin,tasks[t].mainEnd};
+        hash = hashBytes ((const char *) fields,sizeof (fields),hash);
+    }
+    return hash;
+}
+
+// procedure writes the queued records out once an interval, or straight away when closing, syncing the output
+// first when the batch says how long it is, and then the journal
+void checkpointWriter (checkpointLog & log)
+{
+    unique_lock <mutex> hold (log.lock);
+    for (;;)
+    {
+        if (log.every > 0)
+        {
+            log.wake.wait_for (hold,chrono::duration <double> (log.every),[&] { return log.closing; });
+        }
+        else
+        {
+            log.wake.wait (hold,[&] { return log.closing || !log.pending.empty(); });
+        }
+        if (log.pending.empty())
+        {
+            if (log.closing)
+            {
+                return;
+            }
+            continue;
+        }
+        deque <vector <char> > batch;
+        batch.swap (log.pending);
+        bool stacked = log.pendingStacked;
+        log.pendingStacked = false;
+        hold.unlock();
+        
+        if (stacked && log.outputFd >= 0)
+        {
+            fdatasync (log.outputFd);
+        }
+        for (size_t r = 0;r<batch.size();r++)
+        {
+            size_t done = 0;
+            while (done < batch[r].size())
+            {
+                ssize_t wrote = write (log.fd,batch[r].data() + done,batch[r].size() - done);
+                if (wrote < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (wrote < 0)
+                {
+                    cerr << "could not write the checkpoint: " << strerror (errno) << endl;
+                    break;
+                }
+                done += (size_t) wrote;
+            }
+        }
+        fdatasync (log.fd);
+        hold.lock();
+    }
+}
+
+// procedure queues a record: kind, payload size, payload, then a checksum of all three
+void logRecord (checkpointLog & log,unsigned int kind,const vector <char> & payload)
+{
+    vector <char> record (2 * sizeof (unsigned int) + payload.size() + sizeof (unsigned long long));
+    unsigned int size = (unsigned int) payload.size();
+    memcpy (record.data(),&kind,sizeof (kind));
+    memcpy (record.data() + sizeof (kind),&size,sizeof (size));
+    memcpy (record.data() + 2 * sizeof (unsigned int),payload.data(),payload.size());
+    unsigned long long hash = hashBytes (record.data(),record.size() - sizeof (hash),14695981039346656037ull);
+    memcpy (record.data() + record.size() - sizeof (hash),&hash,sizeof (hash));
+    
+    lock_guard <mutex> hold (log.lock);
+    log.pending.push_back (move (record));
+    log.pendingStacked |= kind == stackedRecord;
+    if (log.every <= 0)
+    {
+        log.wake.notify_one();
+    }
+}
+
+// procedure logs the panes a task found since its last record, and where its cursor is now
+void logSearched (checkpointLog & log,unsigned int task,const paneCursorState & state,bool finished,const paneStore & panes)
+{
+    unsigned int flags [2] = {task,finished};
+    unsigned long long count = panes.size();
+    vector <char> payload (sizeof (flags) + sizeof (state) + sizeof (count) + count * sizeof (pane));
+    char * at = payload.data();
+    memcpy (at,flags,sizeof (flags));
+    memcpy (at += sizeof (flags),&state,sizeof (state));
+    memcpy (at += sizeof (state),&count,sizeof (count));
+    at += sizeof (count);
+    for (size_t i = 0;i<panes.size();i++,at += sizeof (pane))
+    {
+        memcpy (at,panes[i].data(),sizeof (pane));
+    }
+    logRecord (log,searchedRecord,payload);
+}
+
+// procedure logs how far stacking has got, flushing the output first so its length on disk is the length logged
+void logStacked (checkpointLog & log,unsigned long long stacked,resultWriter & writer)
+{
+    flushWriter (writer);
+    unsigned long long fields [2] = {stacked,writer.flushed};
+    vector <char> payload ((const char *) fields,(const char *) fields + sizeof (fields));
+    logRecord (log,stackedRecord,payload);
+    log.lastStacked = chrono::steady_clock::now();
+}
+
+// function returns true when a stacking record is due
+bool stackedDue (const checkpointLog & log)
+{
+    return chrono::duration <double> (chrono::steady_clock::now() - log.lastStacked).count() >= log.every;
+}
+
+// function opens the journal. A fresh one gets a header. On resume the old one is read back as far as its last whole
+// record, which says where to carry on from, and is cut there so new records follow on.
+bool openCheckpoint (checkpointLog & log,const string & name,const checkpointHeader & expected,bool resume)
+{
+    checkpointState & state = log.resumed;
+    state.panes.assign (expected.tasks,vector <pane> ());
+    state.cursors.assign (expected.tasks,paneCursorState());
+    state.started.assign (expected.tasks,false);
+    state.finished.assign (expected.tasks,false);
+    
+    if (!resume)
+    {
+        log.fd = open (name.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+        if (log.fd < 0 || write (log.fd,&expected,sizeof (expected)) != (ssize_t) sizeof (expected))
+        {
+            cerr << "could not write " << name << endl;
+            return false;
+        }
+    }
+    else
+    {
+        mappedFile file;
+        if (!mapFile (name.c_str(),file) || file.size < sizeof (checkpointHeader))
+        {
+            cerr << name << " is not there or is not a checkpoint" << endl;
+            unmapFile (file);
+            return false;
+        }
+        checkpointHeader header;
+        memcpy (&header,file.data,sizeof (header));
+        if (memcmp (header.magic,checkpointMagic,sizeof (checkpointMagic)) != 0 || header.version != checkpointVersion)
+        {
+            cerr << name << " is not a checkpoint of this version" << endl;
+            unmapFile (file);
+            return false;
+        }
+        if (header.seed != expected.seed || header.corpusChecksum != expected.corpusChecksum || header.planChecksum != expected.planChecksum || header.tasks != expected.tasks || header.output != expected.output)
+        {
+            cerr << name << " is a checkpoint of a different run" << endl;
+            unmapFile (file);
+            return false;
+        }
+        
+        size_t at = sizeof (header);
+        size_t records = 0;
+        for (;;)
+        {
+            unsigned int kind, size;
+            unsigned long long hash;
+            if (file.size - at < 2 * sizeof (unsigned int) + sizeof (hash))
+            {
+                break;
+            }
+            memcpy (&kind,file.data + at,sizeof (kind));
+            memcpy (&size,file.data + at + sizeof (kind),sizeof (size));
+            size_t length = 2 * sizeof (unsigned int) + (size_t) size + sizeof (hash);
+            if (file.size - at < length)
+            {
+                break;
+            }
+            memcpy (&hash,file.data + at + length - sizeof (hash),sizeof (hash));
+            if (hash != hashBytes (file.data + at,length - sizeof (hash),14695981039346656037ull))
+            {
+                break;
+            }
+            
+            const char * payload = file.data + at + 2 * sizeof (unsigned int);
+            unsigned int flags [2];
+            paneCursorState cursor;
+            unsigned long long count;
+            unsigned long long fields [2];
+            if (kind == searchedRecord && size >= sizeof (flags) + sizeof (cursor) + sizeof (count))
+            {
+                memcpy (flags,payload,sizeof (flags));
+                memcpy (&cursor,payload + sizeof (flags),sizeof (cursor));
+                memcpy (&count,payload + sizeof (flags) + sizeof (cursor),sizeof (count));
+                if (flags[0] >= expected.tasks || size != sizeof (flags) + sizeof (cursor) + sizeof (count) + count * sizeof (pane))
+                {
+                    break;
+                }
+                vector <pane> & panes = state.panes[flags[0]];
+                const char * from = payload + sizeof (flags) + sizeof (cursor) + sizeof (count);
+                for (unsigned long long i = 0;i<count;i++,from += sizeof (pane))
+                {
+                    pane frame;
+                    memcpy (frame.data(),from,sizeof (pane));
+                    panes.push_back (frame);
+                }
+                state.cursors[flags[0]] = cursor;
+                state.started[flags[0]] = true;
+                state.finished[flags[0]] = flags[1] != 0;
+            }
+            else if (kind == stackedRecord && size == sizeof (fields))
+            {
+                memcpy (fields,payload,sizeof (fields));
+                state.stacked = fields[0];
+                state.outputBytes = fields[1];
+            }
+            else
+            {
+                break;
+            }
+            at += length;
+            records++;
+        }
+        unmapFile (file);
+        
+        log.fd = open (name.c_str(),O_WRONLY);
+        if (log.fd < 0 || ftruncate (log.fd,(off_t) at) != 0 || lseek (log.fd,0,SEEK_END) < 0)
+        {
+            cerr << "could not reopen " << name << endl;
+            return false;
+        }
+        unsigned int finished = (unsigned int) count (state.finished.begin(),state.finished.end(),true);
+        cerr << "resuming from " << records << " records: " << finished << " of " << expected.tasks << " tasks searched, " << state.stacked << " first panes stacked" << endl;
+    }
+    
+    log.lastStacked = chrono::steady_clock::now();
+    log.writer = thread (checkpointWriter,ref (log));
+    return true;
+}
+
+// procedure writes out what is queued and closes the journal. A finished fold has nothing to resume, so its journal goes.
+void closeCheckpoint (checkpointLog & log,const string & name,bool finished)
+{
+    {
+        lock_guard <mutex> hold (log.lock);
+        log.closing = true;
+        log.wake.notify_one();
+    }
+    log.writer.join();
+    close (log.fd);
+    if (finished)
+    {
+        remove (name.c_str());
+    }
+}
+
+// procedure searches every task in parallel, dearest first. Panes go to per thread buffers first, then are handed
+// over in task order, so the results come out the same whatever the thread count. Progress is reported by cost.
+// With a journal, every task logs its panes as it goes, and the tasks it shows as finished or in flight are taken
+// from it rather than searched again from the start.
+void getSquares (const adjacency & trees,const vector <squareTask> & tasks,unsigned int threads,const function <void (unsigned int,const pane &)> & handOver,checkpointLog * log = 0)
+{
+    traceSpan span ("search");
+    struct segment
+    {
+        unsigned int worker;
+        size_t begin;
+        size_t end;
+    };
+    
+    vector <paneStore> perThread (threads < 1 ? 1 : threads);
+    vector <paneCursor> cursors (perThread.size());
+    vector <paneStore> staged (log ? perThread.size() : 0); // a checkpointed task's panes since its last record
+    vector <segment> segments (tasks.size());
+    vector <unsigned long long> costs (tasks.size());
+    unsigned long long total = 0;
+    for (size_t task = 0;task<tasks.size();task++)
+    {
+        costs[task] = tasks[task].cost;
+        total += costs[task];
+    }
+    progressMeter progress ("search",total);
+    mutex progressLock;
+    unsigned long long done = 0;
+    
+    runTasks ((unsigned int) tasks.size(),threads,[&] (unsigned int worker,unsigned int task)
+    {
+        traceSpan span ("panes",tasks[task].root);
+        segments[task].worker = worker;
+        segments[task].begin = perThread[worker].size();
+        if (!log)
+        {
+            getSquareRange (tasks[task].root,trees,tasks[task].mainBegin,tasks[task].mainEnd,perThread[worker],cursors[worker]);
+        }
+        else
+        {
+            const checkpointState & resumed = log->resumed;
+            for (size_t i = 0;i<resumed.panes[task].size();i++)
+            {
+                perThread[worker].push (resumed.panes[task][i]);
+            }
+            if (!resumed.finished[task])
+            {
+                paneCursorState state;
+                function <void (paneStore &)> record = [&] (paneStore & panes)
+                {
+                    for (size_t i = 0;i<panes.size();i++)
+                    {
+                        perThread[worker].push (panes[i]);
+                    }
+                    saveCursor (trees,cursors[worker],state);
+                    logSearched (*log,task,state,false,panes);
+                };
+                staged[worker].clear();
+                getSquareRange (tasks[task].root,trees,tasks[task].mainBegin,tasks[task].mainEnd,staged[worker],cursors[worker],&record,checkpointPanes,resumed.started[task] ? &resumed.cursors[task] : 0);
+                for (size_t i = 0;i<staged[worker].size();i++)
+                {
+                    perThread[worker].push (staged[worker][i]);
+                }
+                saveCursor (trees,cursors[worker],state);
+                logSearched (*log,task,state,true,staged[worker]);
+            }
+        }
+        segments[task].end = perThread[worker].size();
+        
+        lock_guard <mutex> hold (progressLock);
+        done += costs[task];
+        progress.tick (done);
+    },&costs);
+    
+    for (unsigned int task = 0;task<tasks.size();task++)
+    {
+        const paneStore & from = perThread[segments[task].worker];
+        for (size_t i = segments[task].begin;i<segments[task].end;i++)
+        {
+            handOver (task,from[i]);
+        }
+    }
+}
+
+// procedure searches every task in parallel and hands each pane to the layer of its task
+void getSquares (const adjacency & trees,const vector <squareTask> & tasks,unsigned int threads,vector <paneStore *> & layers,checkpointLog * log = 0)
+{
+    getSquares (trees,tasks,threads,[&] (unsigned int task,const pane & frame)
+    {
+        layers[tasks[task].layer]->push (frame);
+    },log);
+}
+
+// procedure gathers the roots of a seed's three layers: the seed itself, its children, and its grandchildren.
+// The leaves of the seed are one slice, so the grandchildren are a sorted copy with the repeats dropped.
+void seedRoots (const adjacency & trees,unsigned int seed,vector <unsigned int> roots [3])
+{
+    idSpan children = getChildren (trees,seed);
+    intVector unpacked;
+    idSpan leaves = unpackLeaves (trees,trees.leafOffsets[trees.branchOffsets[seed]],trees.leafOffsets[trees.branchOffsets[seed+1]],unpacked);
+    
+    roots[0].assign (1,seed);
+    roots[1].assign (children.begin(),children.end());
+    roots[2].assign (leaves.begin(),leaves.end());
+    sort (roots[2].begin(),roots[2].end());
+    roots[2].erase (unique (roots[2].begin(),roots[2].end()),roots[2].end());
+}
+
+// The pane cache, for batch mode. The panes of a root do not depend on which seed or layer asked for them, so
+// seeds that share roots share their panes. Each root is searched at most once while it stays cached.
+// Panes are held per root, exactly sized. Once the cache is over its budget, roots not used by the current
+// group of seeds go, least recently used first.
+struct paneCache
+{
+    vector <vector <pane> > panes; // by root
+    vector <unsigned long long> lastUse; // the group that last used the root, zero for never
+    vector <bool> cached;
+    size_t bytes = 0;
+    size_t budget = 0;
+    unsigned long long asked = 0; // roots asked for, counting every seed that asked
+    unsigned long long searched = 0; // roots actually searched
+};
+
+void initPaneCache (paneCache & cache,unsigned int vocabularySize,size_t budget)
+{
+    cache.panes.assign (vocabularySize,vector <pane> ());
+    cache.lastUse.assign (vocabularySize,0);
+    cache.cached.assign (vocabularySize,false);
+    cache.bytes = 0;
+    cache.budget = budget;
+}
+
+// procedure makes sure every root listed is cached, searching all of the missing ones together in one parallel
+// batch so that threads stay busy across the roots of different seeds. It marks the roots as used by the group.
+void fillCache (const adjacency & trees,const vector <unsigned int> & roots,unsigned long long group,unsigned int threads,paneCache & cache)
+{
+    vector <unsigned int> missing;
+    unsigned long long total = 0;
+    cache.asked += roots.size();
+    for (size_t r = 0;r<roots.size();r++)
+    {
+        unsigned int root = roots[r];
+        if (cache.lastUse[root] == group)
+        {
+            continue; // listed twice
+        }
+        cache.lastUse[root] = group;
+        if (cache.cached[root])
+        {
+            continue;
+        }
+        missing.push_back (root);
+        total += rootCost (trees,root);
+    }
+    
+    unsigned long long grain = total / (threads * 64ull) + 1;
+    vector <squareTask> tasks;
+    for (unsigned int r = 0;r<missing.size();r++)
+    {
+        splitRoot (trees,r,missing[r],grain,tasks); // the layer of a task is the place of its root in the missing list
+    }
+    getSquares (trees,tasks,threads,[&] (unsigned int task,const pane & frame)
+    {
+        cache.panes[tasks[task].root].push_back (frame);
+    });
+    
+    for (size_t r = 0;r<missing.size();r++)
+    {
+        vector <pane> & found = cache.panes[missing[r]];
+        found.shrink_to_fit();
+        cache.bytes += found.size() * sizeof (pane);
+        cache.cached[missing[r]] = true;
+        cache.searched++;
+    }
+}
+
+// procedure evicts the least recently used roots until the cache is within budget. Roots of the current group stay,
+// whatever the budget, since their seeds are still to be stacked.
+void trimCache (paneCache & cache,unsigned long long group)
+{
+    if (cache.bytes <= cache.budget)
+    {
+        return;
+    }
+    
+    vector <pair <unsigned long long,unsigned int> > byAge;
+    for (unsigned int root = 0;root<cache.cached.size();root++)
+    {
+        if (cache.cached[root] && cache.lastUse[root] != group)
+        {
+            byAge.push_back (make_pair (cache.lastUse[root],root));
+        }
+    }
+    sort (byAge.begin(),byAge.end());
+    
+    for (size_t i = 0;i<byAge.size() && cache.bytes > cache.budget;i++)
+    {
+        vector <pane> & dropped = cache.panes[byAge[i].second];
+        cache.bytes -= dropped.size() * sizeof (pane);
+        vector <pane> ().swap (dropped);
+        cache.cached[byAge[i].second] = false;
+    }
+}
+
+// procedure lays the cached panes of a list of roots end to end, in the order the roots are listed
+void gatherLayer (const paneCache & cache,const vector <unsigned int> & roots,paneStore & layer)
+{
+    layer.clear();
+    for (size_t r = 0;r<roots.size();r++)
+    {
+        const vector <pane> & found = cache.panes[roots[r]];
+        for (size_t i = 0;i<found.size();i++)
+        {
+            layer.push (found[i]);
+        }
+    }
+}
+
+// function returns true if y is a branch on x
+bool lineUp (unsigned int x, unsigned int y, const adjacency &trees)
+{
+    const membership & members = trees.members;
+    unsigned long long key = bigramKey (x,y);
+    
+    if (members.filtered && !mayContain (members.bigramFilter,key))
+    {
+        return false;
+    }
+    return containsKey (members.bigrams,key); //This will be true if it is found, and there is a lineup
+}
+
+bool check (const pane &first, const pane &second, const adjacency &trees)
+{
+    threadMetrics & counts = metricsHere();
+    counts.checks++;
+    //first[0] second [0] third[0] and so on need to exist
+    for (unsigned int i=0;i<9;i++)
+    {
+        if (!lineUp (first[i],second[i],trees))
+        {
+            return false;
+        }
+    }
+    counts.checksPassed++;
+    return true;
+    
+}
+
+// function returns true if z is a leaf on the branch y of root x
+bool lineUpTwo (unsigned int x, unsigned int y, unsigned int z, const adjacency &trees)
+{
+    const membership & members = trees.members;
+    if (members.packedTrigrams)
+    {
+        unsigned long long key = trigramKey (x,y,z);
+        if (members.filtered && !mayContain (members.trigramFilter,key))
+        {
+            return false;
+        }
+        return containsKey (members.trigrams,key); // true if there is a lineup
+    }
+    
+    unsigned int i= findBranch (trees,x,y); // finding where y is a branch on x
+    if (i == notFound)
+    {
+        return false;
+    }
+    
+    return hasLeaf (trees,i,z); // returns true if it is found. That is, true if there is a lineup
+    
+}
+
+bool checkTwo (const pane &first, const pane &second, const pane &third, const adjacency &trees)
+{
+    threadMetrics & counts = metricsHere();
+    counts.checkTwos++;
+    for (unsigned int i=0;i<9;i++)
+    {
+        if (!lineUpTwo (first[i],second[i], third[i],trees))
+        {
+            return false;
+        }
+    }
+    counts.checkTwosPassed++;
+    return true;
+    
+}
+
+// The batched checks. The join hands over the second panes, or the third panes, of one first pane by the hundred,
+// all tested against the same read only sets, so they are tested together instead of one by one: a cell at a time
+// over every candidate still alive, with each key's home slot fetched a few keys ahead of its probe, so the cache
+// misses of many lookups overlap instead of following one another. Candidates are dropped at their first failing
+// cell, as check() and checkTwo() drop them, so no more lookups are made than those would make. What comes back is
+// a pass bitmask, bit c set when candidate c has all nine cells in the set.
+// A handful of candidates is not worth the batching, and nor is a set small enough to sit in cache, where a probe
+// hardly ever misses; those go through the plain checks.
+const unsigned int verifyBatch = 256; // candidates per batch. Their keys, nine each, stay in L1 between the cells.
+const unsigned int verifyAhead = 8; // keys fetched ahead of the probe
+const unsigned int verifyMinimum = 8; // fewer candidates than this are checked one by one
+const size_t verifySlots = 1 << 17; // sets with fewer slots than this, a megabyte, are checked one by one
+
+// function returns true if a batch of count candidates against the set is worth verifyLineups
+bool worthBatching (const keySet & set,size_t count)
+{
+    return count >= verifyMinimum && set.slots.size() >= verifySlots;
+}
+
+// the working space of verifyLineups
+struct verifyScratch
+{
+    vector <unsigned long long> keys; // nine per candidate, candidate after candidate
+    intVector alive;
+    vector <unsigned long long> pass; // bit c of word c/64 for candidate c
+};
+
+// procedure sets the pass bits of the candidates whose every key is in the set, counting them in the metrics as
+// checks, or as checkTwos when testing trigrams
+void verifyLineups (const keySet & set,const bloomFilter * filter,unsigned int count,bool trigrams,verifyScratch & scratch)
+{
+    const unsigned long long * keys = scratch.keys.data();
+    intVector & alive = scratch.alive;
+    alive.resize (count);
+    for (unsigned int c = 0;c<count;c++)
+    {
+        alive[c] = c;
+    }
+    
+    for (unsigned int k = 0;k<9 && !alive.empty();k++)
+    {
+        unsigned int kept = 0;
+        unsigned int size = (unsigned int) alive.size();
+        for (unsigned int i = 0;i<size;i++)
+        {
+            if (i + verifyAhead < size)
+            {
+                __builtin_prefetch (&set.slots[mixKey (keys[alive[i + verifyAhead]*9 + k]) & set.mask]);
+            }
+            unsigned long long key = keys[alive[i]*9 + k];
+            bool member = (!filter || mayContain (*filter,key)) && containsKey (set,key);
+            alive[kept] = alive[i];
+            kept += member;
+        }
+        alive.resize (kept);
+    }
+    
+    scratch.pass.assign ((count + 63) / 64,0);
+    for (size_t i = 0;i<alive.size();i++)
+    {
+        scratch.pass[alive[i] / 64] |= 1ull << (alive[i] % 64);
+    }
+    
+    threadMetrics & counts = metricsHere();
+    (trigrams ? counts.checkTwos : counts.checks) += count;
+    (trigrams ? counts.checkTwosPassed : counts.checksPassed) += alive.size();
+}
+
+// function returns true if verifyLineups passed candidate c
+bool passed (const verifyScratch & scratch,unsigned int c)
+{
+    return (scratch.pass[c / 64] >> (c % 64)) & 1;
+}
+
+
+
+// procedure outputs a stack of three panes, nine lines of three words and a blank line, or 27 raw ids in binary mode
+void outPutStack (const pane &first, const pane &second, const pane &third, resultWriter & writer)
+{
+    if (writer.keep && !writer.keep (first,second,third))
+    {
+        return;
+    }
+    if (writer.binary)
+    {
+        writeBytes (writer,(const char *) first.data(),sizeof (pane));
+        writeBytes (writer,(const char *) second.data(),sizeof (pane));
+        writeBytes (writer,(const char *) third.data(),sizeof (pane));
+    }
+    else
+    {
+        writePane (writer,first);
+        writePane (writer,second);
+        writePane (writer,third);
+        writeBytes (writer,"\n",1);
+    }
+    
+    if (writer.transposes)
+    {
+        writer.transposes = false; // just the once
+        outPutStack (transposePane (first),transposePane (second),transposePane (third),writer);
+        writer.transposes = true;
+    }
+}
+
+// a pane set indexed for the join. For every cell position it lists the panes holding each word in that cell,
+// laid out like the adjacency index: position k holds the panes [offsets[k][w], offsets[k][w+1]) of panes[k] for word w.
+// Ids are dense, so the table is addressed by the word itself and never hashes or probes. The 3x3 join indexes nine
+// cells; the shape engine indexes as many as its panes have.
+template <unsigned int Cells>
+struct cellIndex
+{
+    intVector offsets [Cells];
+    intVector panes [Cells];
+};
+typedef cellIndex <9> paneIndex;
+
+// procedure indexes a pane set by each of its cells. Panes go in in order, so every bucket is sorted.
+template <class paneSet,unsigned int Cells>
+void buildPaneIndex (const paneSet & frames,unsigned int vocabularySize,cellIndex <Cells> & index)
+{
+    for (unsigned int k = 0;k<Cells;k++)
+    {
+        intVector & offsets = index.offsets[k];
+        offsets.assign (vocabularySize+1,0);
+        for (size_t p = 0;p<frames.size();p++)
+        {
+            offsets[frames[p][k]+1]++;
+        }
+        for (unsigned int w = 0;w<vocabularySize;w++)
+        {
+            offsets[w+1] += offsets[w];
+        }
+        
+        intVector fill (offsets.begin(),offsets.end()-1);
+        index.panes[k].resize (frames.size());
+        for (size_t p = 0;p<frames.size();p++)
+        {
+            index.panes[k][fill[frames[p][k]]++] = (unsigned int) p;
+        }
+    }
+}
+
+// function returns how many panes of the index have one of the allowed words at cell k
+template <unsigned int Cells>
+size_t candidateCount (const cellIndex <Cells> & index,unsigned int k,idSpan allowed)
+{
+    size_t count = 0;
+    for (unsigned int i = 0;i<allowed.size();i++)
+    {
+        count += index.offsets[k][allowed[i]+1] - index.offsets[k][allowed[i]];
+    }
+    return count;
+}
+
+// procedure gathers the panes of the index that have one of the allowed words at cell k
+template <unsigned int Cells>
+void gatherCandidates (const cellIndex <Cells> & index,unsigned int k,idSpan allowed,intVector & candidates)
+{
+    for (unsigned int i = 0;i<allowed.size();i++)
+    {
+        const unsigned int * bucket = index.panes[k].data();
+        candidates.insert (candidates.end(),bucket + index.offsets[k][allowed[i]],bucket + index.offsets[k][allowed[i]+1]);
+    }
+}
+
+// function returns true if the 27 words of a stack are all different
+bool isRepeatFree (const pane &first, const pane &second, const pane &third)
+{
+    unsigned int test [27];
+    memcpy (test,first.data(),sizeof (pane));
+    memcpy (test + 9,second.data(),sizeof (pane));
+    memcpy (test + 18,third.data(),sizeof (pane));
+    
+    return distinctWords (test,27);
+}
+
+// function returns true if a stack reads one of the sorted triples anywhere: along a row or down a column of one of its
+// panes, or through a cell from the first pane to the third
+bool readsAny (const pane &first, const pane &second, const pane &third, const vector <trigram> & triples)
+{
+    const pane * layers [3] = {&first,&second,&third};
+    auto listed = [&] (unsigned int x,unsigned int y,unsigned int z)
+    {
+        trigram t = {x,y,z};
+        return binary_search (triples.begin(),triples.end(),t);
+    };
+    
+    for (unsigned int k = 0;k<9;k++)
+    {
+        if (listed (first[k],second[k],third[k]))
+        {
+            return true;
+        }
+    }
+    for (unsigned int layer = 0;layer<3;layer++)
+    {
+        const pane & frame = *layers[layer];
+        for (unsigned int line = 0;line<3;line++)
+        {
+            if (listed (frame[line*3],frame[line*3+1],frame[line*3+2]) || listed (frame[line],frame[line+3],frame[line+6]))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// the second and third pane sets, each with its cell index, as the join needs them
+struct stackingSide
+{
+    const paneStore * frameTwoRootResults;
+    const paneStore * frameThreeRootResults;
+    paneIndex secondIndex;
+    paneIndex thirdIndex;
+};
+
+// procedure indexes the second and third pane sets for the join
+void buildStackingSide (const paneStore & frameTwoRootResults,const paneStore & frameThreeRootResults,unsigned int vocabularySize,stackingSide & side)
+{
+    traceSpan span ("index panes");
+    side.frameTwoRootResults = &frameTwoRootResults;
+    side.frameThreeRootResults = &frameThreeRootResults;
+    buildPaneIndex (frameTwoRootResults,vocabularySize,side.secondIndex);
+    buildPaneIndex (frameThreeRootResults,vocabularySize,side.thirdIndex);
+}
+
+// the working space of stackPane, kept by the caller between calls so its buffers stop growing
+struct stackScratch
+{
+    intVector seconds;
+    intVector thirds;
+    intVector leaves [9]; // the packed leaves under each (first, second) cell pair, decoded
+    verifyScratch verify;
+};
+
+// The search makes one pane of each pane and transpose pair, but only the first pane of a stack is bound to that
+// orientation: its second and third panes line up with it whichever way round they are. So the join takes later
+// panes both ways round. A candidate names a pane and a way round, 2p for pane p as stored and 2p+1 for its transpose,
+// so candidates in order are panes in order, each before its transpose.
+pane candidatePane (const paneStore & panes,unsigned int candidate)
+{
+    return candidate & 1 ? transposePane (panes[candidate >> 1]) : panes[candidate >> 1];
+}
+
+// procedure gathers the candidates of a pane set that may fit the allowed sets, in order. Each way round is probed
+// through the cell with the fewest panes to try; a transpose holds at cell k what its pane holds at transposedCell (k).
+void gatherOriented (const paneIndex & index,const idSpan allowed [9],intVector & candidates)
+{
+    candidates.clear();
+    for (unsigned int turned = 0;turned<2;turned++)
+    {
+        unsigned int bestCell = 0;
+        size_t bestCount = candidateCount (index,0,allowed[0]);
+        for (unsigned int k = 1;k<9 && bestCount > 0;k++)
+        {
+            size_t count = candidateCount (index,turned ? transposedCell (k) : k,allowed[k]);
+            if (count < bestCount)
+            {
+                bestCell = k;
+                bestCount = count;
+            }
+        }
+        
+        size_t from = candidates.size();
+        gatherCandidates (index,turned ? transposedCell (bestCell) : bestCell,allowed[bestCell],candidates);
+        for (size_t c = from;c<candidates.size();c++)
+        {
+            candidates[c] = candidates[c] * 2 + turned;
+        }
+    }
+    sort (candidates.begin(),candidates.end());
+}
+
+// procedure checks second pane candidates against a first: in batches through the bigram set when worth it, and by check() on
+// each otherwise
+void checkSeconds (const adjacency & trees,const pane & first,const paneStore & panes,intVector & candidates,verifyScratch & scratch)
+{
+    const membership & members = trees.members;
+    if (!worthBatching (members.bigrams,candidates.size()))
+    {
+        unsigned int kept = 0;
+        for (unsigned int c = 0;c<candidates.size();c++)
+        {
+            candidates[kept] = candidates[c];
+            kept += check (first,candidatePane (panes,candidates[c]),trees);
+        }
+        candidates.resize (kept);
+        return;
+    }
+    
+    unsigned int kept = 0;
+    for (size_t start = 0;start<candidates.size();start += verifyBatch)
+    {
+        unsigned int count = (unsigned int) min ((size_t) verifyBatch,candidates.size() - start);
+        scratch.keys.resize (count * 9);
+        for (unsigned int c = 0;c<count;c++)
+        {
+            pane second = candidatePane (panes,candidates[start + c]);
+            for (unsigned int k = 0;k<9;k++)
+            {
+                scratch.keys[c*9 + k] = bigramKey (first[k],second[k]);
+            }
+        }
+        verifyLineups (members.bigrams,members.filtered ? &members.bigramFilter : 0,count,false,scratch);
+        for (unsigned int c = 0;c<count;c++)
+        {
+            candidates[kept] = candidates[start + c];
+            kept += passed (scratch,c);
+        }
+    }
+    candidates.resize (kept);
+}
+
+// procedure checks third pane candidates against a first and second pair: in batches through the trigram set when the set holds
+// them packed and it is worth it, and by checkTwo() on each otherwise
+void checkThirds (const adjacency & trees,const pane & first,const pane & second,const paneStore & panes,intVector & candidates,verifyScratch & scratch)
+{
+    const membership & members = trees.members;
+    if (!members.packedTrigrams || !worthBatching (members.trigrams,candidates.size()))
+    {
+        unsigned int kept = 0;
+        for (unsigned int c = 0;c<candidates.size();c++)
+        {
+            candidates[kept] = candidates[c];
+            kept += checkTwo (first,second,candidatePane (panes,candidates[c]),trees);
+        }
+        candidates.resize (kept);
+        return;
+    }
+    
+    unsigned int kept = 0;
+    for (size_t start = 0;start<candidates.size();start += verifyBatch)
+    {
+        unsigned int count = (unsigned int) min ((size_t) verifyBatch,candidates.size() - start);
+        scratch.keys.resize (count * 9);
+        for (unsigned int c = 0;c<count;c++)
+        {
+            pane third = candidatePane (panes,candidates[start + c]);
+            for (unsigned int k = 0;k<9;k++)
+            {
+                scratch.keys[c*9 + k] = trigramKey (first[k],second[k],third[k]);
+            }
+        }
+        verifyLineups (members.trigrams,members.filtered ? &members.trigramFilter : 0,count,true,scratch);
+        for (unsigned int c = 0;c<count;c++)
+        {
+            candidates[kept] = candidates[start + c];
+            kept += passed (scratch,c);
+        }
+    }
+    candidates.resize (kept);
+}
+
+// procedure joins one first pane against the indexed second and third panes and hands every stack that lines up to found.
+// The second and third panes are taken both ways round. The cell whose successors probe the fewest second panes drives
+// the lookup and checkSeconds() confirms the other eight; the third panes are found the same way from the leaves under
+// each (first, second) cell pair and confirmed by checkThirds(). Matches are put back in candidate order, so stacks come
+// out in pane order, each pane before its transpose.
+void stackPane (const adjacency & trees,const pane & first,const stackingSide & side,stackScratch & scratch,const function <void (const pane &,const pane &,const pane &)> & found)
+{
+    intVector & seconds = scratch.seconds;
+    intVector & thirds = scratch.thirds;
+    
+    idSpan successors [9];
+    for (unsigned int k = 0;k<9;k++)
+    {
+        successors[k] = getChildren (trees,first[k]);
+    }
+    gatherOriented (side.secondIndex,successors,seconds);
+    checkSeconds (trees,first,*side.frameTwoRootResults,seconds,scratch.verify);
+    
+    for (unsigned int sb = 0;sb<seconds.size();sb++)
+    {
+        pane second = candidatePane (*side.frameTwoRootResults,seconds[sb]);
+        
+        // the check has just shown every cell pair is a branch
+        idSpan allowed [9];
+        for (unsigned int k = 0;k<9;k++)
+        {
+            allowed[k] = leafRun (trees,findBranch (trees,first[k],second[k]),0,scratch.leaves[k]);
+        }
+        gatherOriented (side.thirdIndex,allowed,thirds);
+        checkThirds (trees,first,second,*side.frameThreeRootResults,thirds,scratch.verify);
+        
+        for (unsigned int tc = 0;tc<thirds.size();tc++)
+        {
+            found (first,second,candidatePane (*side.frameThreeRootResults,thirds[tc]));
+        }
+    }
+}
+
+// procedure stacks the panes as a join instead of trying every triple. Every first pane is joined in turn
+// and the stacks with no repeated word are output. With a journal, stacking starts after the last first pane it
+// logged and logs its own progress every so often.
+void stackSquares (const adjacency & trees,unsigned int vocabularySize,const paneStore & frameOneRootResults,const paneStore & frameTwoRootResults,const paneStore & frameThreeRootResults,resultWriter & writer,checkpointLog * log = 0)
+{
+    traceSpan span ("stack all");
+    stackingSide side;
+    buildStackingSide (frameTwoRootResults,frameThreeRootResults,vocabularySize,side);
+    
+    stackScratch scratch;
+    function <void (const pane &,const pane &,const pane &)> found = [&] (const pane & first,const pane & second,const pane & third)
+    {
+        if (isRepeatFree (first,second,third))
+        {
+            outPutStack (first,second,third,writer);
+        }
+    };
+    
+    progressMeter progress ("stacked first panes",frameOneRootResults.size());
+    for (unsigned int a = log ? (unsigned int) log->resumed.stacked : 0;a<frameOneRootResults.size();a++)
+    {
+        traceSpan span ("stack",frameOneRootResults[a][0]);
+        stackPane (trees,frameOneRootResults[a],side,scratch,found);
+        progress.tick (a+1);
+        if (log && stackedDue (*log))
+        {
+            logStacked (*log,a+1,writer);
+        }
+    }
+    if (log)
+    {
+        logStacked (*log,frameOneRootResults.size(),writer);
+    }
+}
+
+// a blocking queue with a fixed capacity. push waits while it is full, which is the backpressure between stages;
+// pop waits while it is empty and gives back false once the queue is closed and drained.
+template <typename item>
+struct boundedQueue
+{
+    deque <item> items;
+    size_t capacity;
+    bool closed;
+    mutex lock;
+    condition_variable notFull;
+    condition_variable notEmpty;
+    
+    boundedQueue (size_t most) : capacity (most < 1 ? 1 : most), closed (false) {}
+    
+    void push (item && next)
+    {
+        unique_lock <mutex> hold (lock);
+        notFull.wait (hold,[&] () { return items.size() < capacity; });
+        items.push_back (move (next));
+        notEmpty.notify_one();
+    }
+    
+    bool pop (item & next)
+    {
+        unique_lock <mutex> hold (lock);
+        notEmpty.wait (hold,[&] () { return !items.empty() || closed; });
+        if (items.empty())
+        {
+            return false;
+        }
+        next = move (items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    
+    void close ()
+    {
+        lock_guard <mutex> hold (lock);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+// a stack of three panes on its way to the output stage
+struct paneStack
+{
+    pane first;
+    pane second;
+    pane third;
+};
+
+// how the pipelined mode is laid out
+struct pipelineOptions
+{
+    unsigned int producers; // threads searching first panes
+    unsigned int joiners; // threads stacking them
+    size_t queueBatches; // batches each queue holds before its writers wait
+    size_t batchPanes; // panes per batch between the search and the join
+};
+
+// procedure runs the stacking as a pipeline. The second and third pane sets are the build side of the join and must be
+// complete first; the first panes stream straight out of their search, in batches through a bounded queue, to the join
+// threads, whose stacks go through a second bounded queue to one output thread that drops repeats and writes.
+// Stacks start coming out as soon as the first batch of first panes is joined, and neither the first panes nor the
+// results are ever held in full. Output order depends on thread timing.
+void stackPipeline (const adjacency & trees,unsigned int vocabularySize,const vector <squareTask> & firstTasks,const paneStore & frameTwoRootResults,const paneStore & frameThreeRootResults,const pipelineOptions & options,resultWriter & writer)
+{
+    stackingSide side;
+    buildStackingSide (frameTwoRootResults,frameThreeRootResults,vocabularySize,side);
+    
+    boundedQueue <vector <pane> > firstPanes (options.queueBatches);
+    boundedQueue <vector <paneStack> > stacks (options.queueBatches);
+    
+    // the search stage
+    thread search ([&] ()
+    {
+        unsigned int producers = options.producers < 1 ? 1 : options.producers;
+        vector <paneStore> perThread (producers);
+        vector <paneCursor> cursors (producers);
+        function <void (paneStore &)> drain = [&] (paneStore & panes)
+        {
+            vector <pane> batch (panes.size());
+            for (size_t i = 0;i<panes.size();i++)
+            {
+                batch[i] = panes[i];
+            }
+            firstPanes.push (move (batch));
+        };
+        
+        runTasks ((unsigned int) firstTasks.size(),producers,[&] (unsigned int worker,unsigned int task)
+        {
+            perThread[worker].clear();
+            getSquareRange (firstTasks[task].root,trees,firstTasks[task].mainBegin,firstTasks[task].mainEnd,perThread[worker],cursors[worker],&drain,options.batchPanes);
+            if (!perThread[worker].empty())
+            {
+                drain (perThread[worker]);
+            }
+        });
+        firstPanes.close();
+    });
+    
+    // the join stage
+    vector <thread> joiners;
+    unsigned int joinerCount = options.joiners < 1 ? 1 : options.joiners;
+    for (unsigned int j = 0;j<joinerCount;j++)
+    {
+        joiners.push_back (thread ([&] ()
+        {
+            stackScratch scratch;
+            vector <paneStack> found;
+            function <void (const pane &,const pane &,const pane &)> keep = [&] (const pane & first,const pane & second,const pane & third)
+            {
+                paneStack next;
+                next.first = first;
+                next.second = second;
+                next.third = third;
+                found.push_back (next);
+            };
+            
+            vector <pane> batch;
+            while (firstPanes.pop (batch))
+            {
+                traceSpan span ("join batch");
+                for (size_t i = 0;i<batch.size();i++)
+                {
+                    stackPane (trees,batch[i],side,scratch,keep);
+                }
+                if (!found.empty())
+                {
+                    stacks.push (move (found));
+                    found.clear();
+                }
+            }
+        }));
+    }
+    
+    // the output stage
+    thread output ([&] ()
+    {
+        vector <paneStack> batch;
+        while (stacks.pop (batch))
+        {
+            for (size_t i = 0;i<batch.size();i++)
+            {
+                if (isRepeatFree (batch[i].first,batch[i].second,batch[i].third))
+                {
+                    outPutStack (batch[i].first,batch[i].second,batch[i].third,writer);
+                }
+            }
+        }
+    });
+    
+    search.join();
+    for (unsigned int j = 0;j<joinerCount;j++)
+    {
+        joiners[j].join();
+    }
+    stacks.close();
+    output.join();
+}
+
+// a pane a constrained search found, with the frame the cursor made it from and which way round the join takes it
+struct constrainedMatch
+{
+    pane made;
+    pane frame;
+    bool turned; // the transpose of the pane getSquareRange would store
+};
+
+// function returns true if the cursor makes frame x before frame y. It walks (b, c) and then (d, g) in id order, and
+// each level's candidates are sorted, so that is the order of the cells as they are filled.
+bool madeBefore (const pane & x,const pane & y)
+{
+    static const unsigned int order [8] = {1,2,3,6,4,7,5,8};
+    for (unsigned int k = 0;k<8;k++)
+    {
+        if (x[order[k]] != y[order[k]])
+        {
+            return x[order[k]] < y[order[k]];
+        }
+    }
+    return false;
+}
+
+// the cursor and the matches of one level of a constrained search
+struct constrainedSearch
+{
+    paneCursor cursor;
+    vector <constrainedMatch> matches;
+};
+
+// procedure finds the panes of a root that fit the allowed sets either way round, and hands them to found in the order
+// the join takes them: the panes as getSquareRange stores them, in the order it makes them, each before its transpose.
+// The root is searched with the allowed sets and again with them transposed, which finds the panes whose transposes
+// fit, and the two are merged by the order the cursor made them in. The search stops as soon as found returns false,
+// and then so does this, returning false.
+bool constrainedPanes (const adjacency & trees,unsigned int root,const idSpan allowed [9],constrainedSearch & search,const function <bool (const pane &)> & found)
+{
+    unsigned int leaves = grandchildCount (trees,root);
+    vector <constrainedMatch> & matches = search.matches;
+    matches.clear();
+    
+    idSpan flipped [9];
+    for (unsigned int k = 0;k<9;k++)
+    {
+        flipped[k] = allowed[transposedCell (k)];
+    }
+    for (unsigned int pass = 0;pass<2;pass++)
+    {
+        constrainedMatch match;
+        openCursor (trees,root,0,leaves,search.cursor,pass ? flipped : allowed);
+        while (nextPane (trees,search.cursor,match.made))
+        {
+            match.frame = pass ? transposePane (match.made) : match.made;
+            match.turned = (pass != 0) == firstSeenCanonical (trees,match.made);
+            matches.push_back (match);
+        }
+    }
+    sort (matches.begin(),matches.end(),[] (const constrainedMatch & x,const constrainedMatch & y)
+    {
+        return madeBefore (x.made,y.made) || (!madeBefore (y.made,x.made) && x.turned < y.turned);
+    });
+    
+    for (size_t m = 0;m<matches.size();m++)
+    {
+        if (!found (matches[m].frame))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the searches and buffers one thread stacks with
+struct constrainedScratch
+{
+    constrainedSearch second;
+    constrainedSearch third;
+    stackScratch leaves;
+};
+
+// procedure stacks one first pane without searching the second and third layers in full. The first pane constrains
+// the search for its second panes, cell by cell, to the successors of its own words, and each first and second pair
+// constrains the search for its third panes to the words that follow both. Whatever is found lines up by construction,
+// so only repeats are left to check. A second pane that secondFits turns down, given the words each third cell may
+// hold, is not searched under, and the search stops as soon as found returns false.
+void stackFirstPane (const adjacency & trees,const pane & first,constrainedScratch & scratch,const function <bool (const paneStack &)> & found,const function <bool (const pane &,const idSpan [9])> & secondFits = nullptr)
+{
+    paneStack next;
+    next.first = first;
+    
+    idSpan secondAllowed [9];
+    for (unsigned int k = 0;k<9;k++)
+    {
+        secondAllowed[k] = getChildren (trees,first[k]);
+    }
+    
+    function <bool (const pane &)> foundThird = [&] (const pane & third)
+    {
+        next.third = third;
+        return !isRepeatFree (next.first,next.second,next.third) || found (next);
+    };
+    function <bool (const pane &)> foundSecond = [&] (const pane & second)
+    {
+        next.second = second;
+        idSpan thirdAllowed [9];
+        for (unsigned int k = 0;k<9;k++)
+        {
+            thirdAllowed[k] = leafRun (trees,findBranch (trees,first[k],second[k]),0,scratch.leaves.leaves[k]);
+        }
+        if (secondFits && !secondFits (second,thirdAllowed))
+        {
+            return true;
+        }
+        for (unsigned int t = 0;t<thirdAllowed[0].size();t++)
+        {
+            if (!constrainedPanes (trees,thirdAllowed[0][t],thirdAllowed,scratch.third,foundThird))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    
+    for (unsigned int r = 0;r<secondAllowed[0].size();r++)
+    {
+        if (!constrainedPanes (trees,secondAllowed[0][r],secondAllowed,scratch.second,foundSecond))
+        {
+            return;
+        }
+    }
+}
+
+// procedure stacks each first pane by stackFirstPane. This pays when first panes are few; with many, searching each
+// layer once for the join costs less.
+// First panes are shared out between threads a chunk at a time, and each chunk's stacks are written in order,
+// which is the order stackSquares writes them in.
+void stackConstrained (const adjacency & trees,const paneStore & frameOneRootResults,unsigned int threads,resultWriter & writer)
+{
+    size_t chunk = threads * 4;
+    vector <vector <paneStack> > found (chunk);
+    vector <constrainedScratch> scratch (threads);
+    progressMeter progress ("stacked first panes",frameOneRootResults.size());
+    
+    for (size_t start = 0;start<frameOneRootResults.size();start += chunk)
+    {
+        size_t end = min (frameOneRootResults.size(),start + chunk);
+        runTasks ((unsigned int) (end - start),threads,[&] (unsigned int worker,unsigned int task)
+        {
+            traceSpan span ("stack",frameOneRootResults[start + task][0]);
+            vector <paneStack> & stacks = found[task];
+            stacks.clear();
+            stackFirstPane (trees,frameOneRootResults[start + task],scratch[worker],[&] (const paneStack & stack)
+            {
+                stacks.push_back (stack);
+                return true;
+            });
+        });
+        
+        progress.tick (end);
+        for (size_t task = 0;task<end - start;task++)
+        {
+            for (size_t i = 0;i<found[task].size();i++)
+            {
+                outPutStack (found[task][i].first,found[task][i].second,found[task][i].third,writer);
+            }
+        }
+    }
+}
+
+// A query asks for at most limit stacks of one seed. Unscored, they are the first limit stacks the full search would
+// write, in its order, and the search stops once they are found. Scored, they are the limit best stacks by the
+// summed corpus counts of their 27 words, best first, ties going to the one found first. First panes are then stacked
+// in the order of a bound on what any stack over them can score, keeping the best so far in a heap of limit stacks,
+// and the search stops when the next bound cannot beat the worst of them. Either way the cost follows the limit,
+// not the number of stacks the seed has.
+struct stackQuery
+{
+    size_t limit = 0; // zero means no query, every stack is written
+    bool scored = false;
+};
+
+// a stack kept by a scored query, with where it was found for breaking ties
+struct rankedStack
+{
+    unsigned long long score;
+    size_t source; // the first pane's place in bound order
+    size_t found; // the stack's place among that pane's
+    paneStack stack;
+};
+
+// function returns true if x ranks ahead of y
+bool rankedBefore (const rankedStack & x,const rankedStack & y)
+{
+    if (x.score != y.score)
+    {
+        return x.score > y.score;
+    }
+    if (x.source != y.source)
+    {
+        return x.source < y.source;
+    }
+    return x.found < y.found;
+}
+
+// procedure puts a stack into a heap of the best limit, whose front is the worst of them
+void offerStack (vector <rankedStack> & heap,size_t limit,const rankedStack & stack)
+{
+    if (heap.size() == limit)
+    {
+        if (!rankedBefore (stack,heap.front()))
+        {
+            return;
+        }
+        pop_heap (heap.begin(),heap.end(),rankedBefore);
+        heap.pop_back();
+    }
+    heap.push_back (stack);
+    push_heap (heap.begin(),heap.end(),rankedBefore);
+}
+
+// function returns the summed counts of a pane's words
+unsigned long long paneScore (const vector <unsigned long long> & counts,const pane & frame)
+{
+    unsigned long long score = 0;
+    for (unsigned int k = 0;k<9;k++)
+    {
+        score += counts[frame[k]];
+    }
+    return score;
+}
+
+// procedure runs an unscored query: stackConstrained, stopping at the limit. Each first pane also stops at what the
+// limit still wants, so no chunk finds much more than it needs.
+void firstStacks (const adjacency & trees,const paneStore & frameOneRootResults,unsigned int threads,size_t limit,resultWriter & writer)
+{
+    size_t chunk = threads * 4;
+    vector <vector <paneStack> > found (chunk);
+    vector <constrainedScratch> scratch (threads);
+    size_t written = 0;
+    size_t start = 0;
+    
+    for (;start<frameOneRootResults.size() && written<limit;start += chunk)
+    {
+        size_t end = min (frameOneRootResults.size(),start + chunk);
+        size_t wanted = limit - written;
+        runTasks ((unsigned int) (end - start),threads,[&] (unsigned int worker,unsigned int task)
+        {
+            traceSpan span ("stack",frameOneRootResults[start + task][0]);
+            vector <paneStack> & stacks = found[task];
+            stacks.clear();
+            stackFirstPane (trees,frameOneRootResults[start + task],scratch[worker],[&] (const paneStack & stack)
+            {
+                if (!writer.keep || writer.keep (stack.first,stack.second,stack.third))
+                {
+                    stacks.push_back (stack);
+                }
+                return stacks.size() < wanted;
+            });
+        });
+        
+        for (size_t task = 0;task<end - start;task++)
+        {
+            for (size_t i = 0;i<found[task].size() && written<limit;i++,written++)
+            {
+                outPutStack (found[task][i].first,found[task][i].second,found[task][i].third,writer);
+            }
+        }
+    }
+    cerr << written << " stacks from " << min (start,frameOneRootResults.size()) << " of " << frameOneRootResults.size() << " first panes" << endl;
+}
+
+// procedure runs a scored query. A stack's second pane follows its first cell by cell and its third follows its
+// second, so the most any stack over a first pane can score is the first's own counts and, cell by cell, the most
+// any successor of the word and any word two on from it counts. Each second pane is bounded again by the most its
+// third cells' allowed words count before its third panes are searched.
+void bestStacks (const adjacency & trees,const vocabulary & dictionary,const paneStore & frameOneRootResults,unsigned int threads,size_t limit,resultWriter & writer)
+{
+    const vector <unsigned long long> & counts = dictionary.counts; // kept from the load, or from the snapshot
+    
+    unsigned int vocabularySize = (unsigned int) dictionary.words.size();
+    vector <unsigned long long> bestNext (vocabularySize,0); // the most any successor of the word counts
+    vector <unsigned long long> bestAfter (vocabularySize,0); // the most any word two on counts
+    intVector unpacked;
+    for (unsigned int word = 0;word<vocabularySize;word++)
+    {
+        idSpan children = getChildren (trees,word);
+        for (unsigned int c = 0;c<children.size();c++)
+        {
+            bestNext[word] = max (bestNext[word],counts[children[c]]);
+        }
+        idSpan after = unpackLeaves (trees,trees.leafOffsets[trees.branchOffsets[word]],trees.leafOffsets[trees.branchOffsets[word+1]],unpacked);
+        for (unsigned int a = 0;a<after.size();a++)
+        {
+            bestAfter[word] = max (bestAfter[word],counts[after[a]]);
+        }
+    }
+    
+    vector <unsigned long long> bounds (frameOneRootResults.size());
+    vector <size_t> order (frameOneRootResults.size());
+    for (size_t f = 0;f<frameOneRootResults.size();f++)
+    {
+        const pane & first = frameOneRootResults[f];
+        bounds[f] = paneScore (counts,first);
+        for (unsigned int k = 0;k<9;k++)
+        {
+            bounds[f] += bestNext[first[k]] + bestAfter[first[k]];
+        }
+        order[f] = f;
+    }
+    stable_sort (order.begin(),order.end(),[&] (size_t x,size_t y) { return bounds[x] > bounds[y]; });
+    
+    size_t chunk = threads * 4;
+    vector <vector <rankedStack> > found (chunk);
+    vector <constrainedScratch> scratch (threads);
+    vector <rankedStack> best;
+    size_t start = 0;
+    
+    for (;start<order.size();start += chunk)
+    {
+        // a stack over a later first pane only gets in by beating the worst kept, as it loses ties
+        bool full = best.size() == limit;
+        unsigned long long floor = full ? best.front().score : 0;
+        if (full && bounds[order[start]] <= floor)
+        {
+            break;
+        }
+        
+        size_t end = min (order.size(),start + chunk);
+        runTasks ((unsigned int) (end - start),threads,[&] (unsigned int worker,unsigned int task)
+        {
+            const pane & first = frameOneRootResults[order[start + task]];
+            traceSpan span ("stack",first[0]);
+            vector <rankedStack> & kept = found[task];
+            kept.clear();
+            
+            unsigned long long firstScore = paneScore (counts,first);
+            rankedStack next;
+            next.source = start + task;
+            next.found = 0;
+            stackFirstPane (trees,first,scratch[worker],[&] (const paneStack & stack)
+            {
+                next.score = firstScore + paneScore (counts,stack.second) + paneScore (counts,stack.third);
+                if ((!full || next.score > floor) && (!writer.keep || writer.keep (stack.first,stack.second,stack.third)))
+                {
+                    next.stack = stack;
+                    offerStack (kept,limit,next);
+                }
+                next.found++;
+                return true;
+            },[&] (const pane & second,const idSpan thirdAllowed [9])
+            {
+                if (!full)
+                {
+                    return true;
+                }
+                unsigned long long bound = firstScore + paneScore (counts,second);
+                for (unsigned int k = 0;k<9;k++)
+                {
+                    unsigned long long most = 0;
+                    for (unsigned int t = 0;t<thirdAllowed[k].size();t++)
+                    {
+                        most = max (most,counts[thirdAllowed[k][t]]);
+                    }
+                    bound += most;
+                }
+                return bound > floor;
+            });
+        });
+        
+        for (size_t task = 0;task<end - start;task++)
+        {
+            for (size_t i = 0;i<found[task].size();i++)
+            {
+                offerStack (best,limit,found[task][i]);
+            }
+        }
+    }
+    cerr << best.size() << " stacks from " << min (start,order.size()) << " of " << order.size() << " first panes";
+    if (start < order.size())
+    {
+        cerr << ", the rest cannot beat them";
+    }
+    cerr << endl;
+    
+    sort_heap (best.begin(),best.end(),rankedBefore);
+    for (size_t i = 0;i<best.size();i++)
+    {
+        outPutStack (best[i].stack.first,best[i].stack.second,best[i].stack.third,writer);
+    }
+}
+
+// procedure runs batch mode. Seeds go in groups: the roots of a whole group are searched together, skipping any
+// already cached, then each seed of the group is stacked from the cache in turn, the same as a run of its own would.
+// In text output each seed's stacks follow a line naming it; binary stacks name their seed in their first word.
+void stackSeeds (const adjacency & trees,const vocabulary & dictionary,const vector <unsigned int> & seeds,unsigned int groupSize,unsigned int threads,size_t cacheBytes,resultWriter & writer)
+{
+    unsigned int vocabularySize = (unsigned int) dictionary.words.size();
+    paneCache cache;
+    initPaneCache (cache,vocabularySize,cacheBytes);
+    
+    paneStore frameOneRootResults;
+    paneStore frameTwoRootResults;
+    paneStore frameThreeRootResults;
+    unsigned long long group = 0;
+    
+    for (size_t start = 0;start<seeds.size();start += groupSize)
+    {
+        size_t end = min (seeds.size(),start + groupSize);
+        group++;
+        
+        vector <unsigned int> groupRoots;
+        for (size_t s = start;s<end;s++)
+        {
+            vector <unsigned int> roots [3];
+            seedRoots (trees,seeds[s],roots);
+            for (unsigned int layer = 0;layer<3;layer++)
+            {
+                groupRoots.insert (groupRoots.end(),roots[layer].begin(),roots[layer].end());
+            }
+        }
+        cerr << "seeds " << start << " to " << end << ": get the panes of " << groupRoots.size() << " roots" << endl;
+        {
+            traceSpan span ("fill cache");
+            fillCache (trees,groupRoots,group,threads,cache);
+        }
+        
+        for (size_t s = start;s<end;s++)
+        {
+            vector <unsigned int> roots [3];
+            seedRoots (trees,seeds[s],roots);
+            gatherLayer (cache,roots[0],frameOneRootResults);
+            gatherLayer (cache,roots[1],frameTwoRootResults);
+            gatherLayer (cache,roots[2],frameThreeRootResults);
+            
+            if (!writer.binary)
+            {
+                writeBytes (writer,"seed ",5);
+                writeWord (writer,seeds[s]);
+                writeBytes (writer,"\n",1);
+            }
+            cerr << "stack the squares of " << dictionary.words[seeds[s]] << endl;
+            stackSquares (trees,vocabularySize,frameOneRootResults,frameTwoRootResults,frameThreeRootResults,writer);
+        }
+        
+        trimCache (cache,group);
+    }
+    cerr << "roots asked for: " << cache.asked << ", searched: " << cache.searched << ", left cached: " << cache.bytes / (1 << 20) << "MB" << endl;
+}
+
+// Sharded runs, for splitting one seed's search between machines that each hold the same index (a copy of the same
+// snapshot, say). A shard searches its share of the seed's roots and writes their panes, and the coordinator reads
+// back the shards it is given, searches any missing ones itself, and stacks. A shard that failed is just run again,
+// on any machine, on its own. Roots are shared out by their run counts from maximum(), heaviest first, each going to
+// the shard with the least so far, so a root with a huge fan out does not leave the others idle. Every process works
+// the plan out the same way from the index, and each shard file carries the plan's checksum so files from a
+// different seed, corpus or shard count are turned away.
+const char shardMagic [8] = {'F','O','L','D','S','H','R','D'};
+const unsigned int shardVersion = 1;
+
+struct shardHeader
+{
+    char magic [8];
+    unsigned int version;
+    unsigned int shards;
+    unsigned int shard;
+    unsigned int seed;
+    unsigned long long corpusChecksum;
+    unsigned long long planChecksum;
+    unsigned long long roots; // entries that follow: the root, its pane count as 64 bits, then its panes
+};
+
+// the roots of a seed's three layers, and the shard each of them goes to
+struct shardPlan
+{
+    vector <unsigned int> roots; // sorted, without repeats
+    intVector owner;
+    unsigned long long checksum;
+};
+
+// procedure works out which shard searches each root of the seed
+void planShards (const adjacency & trees,unsigned int seed,unsigned int shards,shardPlan & plan)
+{
+    vector <unsigned int> layers [3];
+    seedRoots (trees,seed,layers);
+    plan.roots.clear();
+    for (unsigned int layer = 0;layer<3;layer++)
+    {
+        plan.roots.insert (plan.roots.end(),layers[layer].begin(),layers[layer].end());
+    }
+    sort (plan.roots.begin(),plan.roots.end());
+    plan.roots.erase (unique (plan.roots.begin(),plan.roots.end()),plan.roots.end());
+    
+    vector <unsigned long long> runs (plan.roots.size());
+    intVector heaviest (plan.roots.size());
+    for (unsigned int r = 0;r<plan.roots.size();r++)
+    {
+        runs[r] = maximum (trees,plan.roots[r]);
+        heaviest[r] = r;
+    }
+    stable_sort (heaviest.begin(),heaviest.end(),[&] (unsigned int x,unsigned int y) { return runs[x] > runs[y]; });
+    
+    vector <unsigned long long> load (shards,0);
+    plan.owner.assign (plan.roots.size(),0);
+    for (unsigned int i = 0;i<heaviest.size();i++)
+    {
+        unsigned int lightest = (unsigned int) (min_element (load.begin(),load.end()) - load.begin());
+        plan.owner[heaviest[i]] = lightest;
+        load[lightest] += runs[heaviest[i]];
+    }
+    
+    plan.checksum = hashBytes ((const char *) &shards,sizeof (shards),14695981039346656037ull);
+    plan.checksum = hashBytes ((const char *) plan.roots.data(),plan.roots.size() * sizeof (unsigned int),plan.checksum);
+    plan.checksum = hashBytes ((const char *) plan.owner.data(),plan.owner.size() * sizeof (unsigned int),plan.checksum);
+}
+
+// procedure searches one shard's roots and writes their panes through the writer
+void writeShard (const adjacency & trees,const vocabulary & dictionary,unsigned int seed,unsigned int shards,unsigned int shard,unsigned int threads,resultWriter & writer)
+{
+    shardPlan plan;
+    planShards (trees,seed,shards,plan);
+    vector <unsigned int> mine;
+    unsigned long long runs = 0;
+    for (unsigned int r = 0;r<plan.roots.size();r++)
+    {
+        if (plan.owner[r] == shard)
+        {
+            mine.push_back (plan.roots[r]);
+            runs += maximum (trees,plan.roots[r]);
+        }
+    }
+    cerr << "shard " << shard << " of " << shards << ": " << mine.size() << " of " << plan.roots.size() << " roots, " << runs << " runs" << endl;
+    
+    paneCache cache;
+    initPaneCache (cache,(unsigned int) dictionary.words.size(),~(size_t) 0);
+    fillCache (trees,mine,1,threads,cache);
+    
+    shardHeader header;
+    memset (&header,0,sizeof (header));
+    memcpy (header.magic,shardMagic,sizeof (shardMagic));
+    header.version = shardVersion;
+    header.shards = shards;
+    header.shard = shard;
+    header.seed = seed;
+    header.corpusChecksum = quickChecksum (dictionary.file);
+    header.planChecksum = plan.checksum;
+    header.roots = mine.size();
+    writeBytes (writer,(const char *) &header,sizeof (header));
+    for (size_t r = 0;r<mine.size();r++)
+    {
+        const vector <pane> & found = cache.panes[mine[r]];
+        unsigned long long count = found.size();
+        writeBytes (writer,(const char *) &mine[r],sizeof (unsigned int));
+        writeBytes (writer,(const char *) &count,sizeof (count));
+        writeBytes (writer,(const char *) found.data(),found.size() * sizeof (pane));
+    }
+}
+
+// function reads a shard file into the cache and gives back its shard number, or notFound, with a reason, when the
+// file is not a whole shard of this run
+unsigned int readShard (const string & name,const vocabulary & dictionary,unsigned int seed,unsigned int shards,const shardPlan & plan,paneCache & cache)
+{
+    mappedFile file;
+    auto reject = [&] (const string & reason)
+    {
+        cerr << name << reason << endl;
+        unmapFile (file);
+        return notFound;
+    };
+    
+    if (!mapFile (name.c_str(),file) || file.size < sizeof (shardHeader))
+    {
+        return reject (" is not there or is not a shard");
+    }
+    shardHeader header;
+    memcpy (&header,file.data,sizeof (header));
+    if (memcmp (header.magic,shardMagic,sizeof (shardMagic)) != 0 || header.version != shardVersion)
+    {
+        return reject (" is not a shard of this version");
+    }
+    if (header.shards != shards || header.shard >= shards || header.seed != seed || header.corpusChecksum != quickChecksum (dictionary.file) || header.planChecksum != plan.checksum)
+    {
+        return reject (" is a shard of a different run");
+    }
+    
+    unsigned long long expected = 0;
+    for (unsigned int r = 0;r<plan.roots.size();r++)
+    {
+        expected += plan.owner[r] == header.shard;
+    }
+    if (header.roots != expected)
+    {
+        return reject (" does not hold all of its roots");
+    }
+    
+    // check it all before taking any of it, so that a bad file leaves the cache as it was
+    struct shardEntry
+    {
+        unsigned int root;
+        size_t at; // where its panes start
+        unsigned long long count;
+    };
+    vector <shardEntry> entries;
+    size_t at = sizeof (header);
+    for (unsigned long long e = 0;e<header.roots;e++)
+    {
+        unsigned int root;
+        unsigned long long count;
+        if (file.size - at < sizeof (root) + sizeof (count))
+        {
+            return reject (" is cut short");
+        }
+        memcpy (&root,file.data + at,sizeof (root));
+        memcpy (&count,file.data + at + sizeof (root),sizeof (count));
+        at += sizeof (root) + sizeof (count);
+        
+        auto listed = lower_bound (plan.roots.begin(),plan.roots.end(),root);
+        if (listed == plan.roots.end() || *listed != root || plan.owner[listed - plan.roots.begin()] != header.shard)
+        {
+            return reject (" holds a root that is not its own");
+        }
+        if (count > (file.size - at) / sizeof (pane))
+        {
+            return reject (" is cut short");
+        }
+        shardEntry entry = {root,at,count};
+        entries.push_back (entry);
+        at += count * sizeof (pane);
+    }
+    
+    for (size_t e = 0;e<entries.size();e++)
+    {
+        vector <pane> & found = cache.panes[entries[e].root];
+        found.resize (entries[e].count);
+        memcpy (found.data(),file.data + entries[e].at,found.size() * sizeof (pane));
+        cache.bytes += found.size() * sizeof (pane);
+        cache.cached[entries[e].root] = true;
+    }
+    unmapFile (file);
+    return header.shard;
+}
+
+// procedure runs the coordinator: it takes the panes of the shard files, searches the roots of any shard that did not
+// come back, and stacks. Stacks come out the same as a run on one machine.
+void gatherShards (const adjacency & trees,const vocabulary & dictionary,unsigned int seed,unsigned int shards,const vector <string> & names,unsigned int threads,resultWriter & writer)
+{
+    unsigned int vocabularySize = (unsigned int) dictionary.words.size();
+    shardPlan plan;
+    planShards (trees,seed,shards,plan);
+    paneCache cache;
+    initPaneCache (cache,vocabularySize,~(size_t) 0);
+    
+    vector <bool> delivered (shards,false);
+    for (size_t n = 0;n<names.size();n++)
+    {
+        unsigned int shard = readShard (names[n],dictionary,seed,shards,plan,cache);
+        if (shard != notFound)
+        {
+            delivered[shard] = true;
+        }
+    }
+    intVector rootsOf (shards,0);
+    for (unsigned int r = 0;r<plan.roots.size();r++)
+    {
+        rootsOf[plan.owner[r]]++;
+    }
+    unsigned int rerun = 0;
+    for (unsigned int shard = 0;shard<shards;shard++)
+    {
+        if (!delivered[shard])
+        {
+            cerr << (rerun++ ? ", " : "did not come back, searching here: shard ") << shard << " (" << rootsOf[shard] << " roots)";
+        }
+    }
+    cerr << (rerun ? "" : "every shard came back") << endl;
+    fillCache (trees,plan.roots,1,threads,cache); // searches only the roots no shard delivered
+    
+    vector <unsigned int> roots [3];
+    seedRoots (trees,seed,roots);
+    paneStore frameOneRootResults;
+    paneStore frameTwoRootResults;
+    paneStore frameThreeRootResults;
+    gatherLayer (cache,roots[0],frameOneRootResults);
+    gatherLayer (cache,roots[1],frameTwoRootResults);
+    gatherLayer (cache,roots[2],frameThreeRootResults);
+    cerr << "stack the squares" << endl;
+    stackSquares (trees,vocabularySize,frameOneRootResults,frameTwoRootResults,frameThreeRootResults,writer);
+}
+
+// The shape engine, for folds other than three 3x3 panes. A fold of shape width x height x depth is depth panes of
+// height rows by width columns: every row is a width-gram, every column a height-gram, every cell read down through
+// the panes a depth-gram, and no word comes up twice. The index holds bigrams and trigrams, so each of the three is
+// 2 or 3. The shape is fixed at compile time: a pane is a plain array, and the cells and the layers are filled by
+// template recursions that unroll into one loop nest per shape. seedRoots gives the roots of each layer.
+// Square panes are made in one orientation only, as the cursor makes them: cell (0,1) earlier than cell (1,0) when
+// the words are counted in first seen order. That binds a stack's first pane; the later ones are taken both ways
+// round. Through the engine, 3x3x3 finds the same stacks as the paths above.
+template <unsigned int Order>
+bool lineUpOrder (const unsigned int * column,const adjacency & trees)
+{
+    static_assert (Order == 2 || Order == 3,"the index holds bigrams and trigrams only");
+    if constexpr (Order == 2)
+    {
+        return lineUp (column[0],column[1],trees);
+    }
+    else
+    {
+        return lineUpTwo (column[0],column[1],column[2],trees);
+    }
+}
+
+// function gives back the words that can follow one word (its children) or two (the leaves of their branch slot)
+template <unsigned int Before>
+idSpan followers (const adjacency & trees,const unsigned int * before,intVector & scratch)
+{
+    if constexpr (Before == 1)
+    {
+        return getChildren (trees,before[0]);
+    }
+    else
+    {
+        unsigned int slot = findBranch (trees,before[0],before[1]);
+        assert (slot != notFound);
+        return leafRun (trees,slot,0,scratch);
+    }
+}
+
+template <unsigned int Width,unsigned int Height,unsigned int Depth>
+struct shapeEngine
+{
+    static_assert (Width >= 2 && Width <= 3 && Height >= 2 && Height <= 3 && Depth >= 2 && Depth <= 3,"the index holds bigrams and trigrams only");
+    static constexpr unsigned int cells = Width * Height;
+    typedef array <unsigned int,cells> shapedPane;
+    typedef array <shapedPane,Depth> shapedStack;
+    static_assert (sizeof (shapedStack) == cells * Depth * sizeof (unsigned int),"a stack is its words back to back");
+    
+    // the search of one root, with a candidate buffer and decoding scratch for every cell
+    struct paneSearch
+    {
+        const adjacency & trees;
+        vector <shapedPane> & found;
+        shapedPane current;
+        intVector candidates [cells];
+        intVector rowLeaves [cells];
+        intVector columnLeaves [cells];
+        
+        paneSearch (const adjacency & on,vector <shapedPane> & into) : trees (on), found (into) {}
+        
+        // function returns the word as first seen order numbers it, which picks the orientation of a square pane
+        unsigned int firstSeen (unsigned int word) const
+        {
+            return trees.firstSeen.empty() ? word : trees.firstSeen[word];
+        }
+        
+        // procedure fills cell Cell and every cell after it in reading order. A cell's words follow the ones before it in
+        // its row and the ones above it in its column, so its candidates are the intersection of two follower runs.
+        template <unsigned int Cell>
+        void fill ()
+        {
+            if constexpr (Cell == cells)
+            {
+                found.push_back (current);
+            }
+            else
+            {
+                constexpr unsigned int row = Cell / Width;
+                constexpr unsigned int col = Cell % Width;
+                idSpan options;
+                if constexpr (row == 0)
+                {
+                    options = followers <col> (trees,&current[Cell-col],rowLeaves[Cell]);
+                }
+                else if constexpr (col == 0)
+                {
+                    unsigned int above [row];
+                    for (unsigned int k = 0;k<row;k++)
+                    {
+                        above[k] = current[Cell - (row-k) * Width];
+                    }
+                    options = followers <row> (trees,above,columnLeaves[Cell]);
+                }
+                else
+                {
+                    unsigned int above [row];
+                    for (unsigned int k = 0;k<row;k++)
+                    {
+                        above[k] = current[Cell - (row-k) * Width];
+                    }
+                    idSpan across = followers <col> (trees,&current[Cell-col],rowLeaves[Cell]);
+                    idSpan down = followers <row> (trees,above,columnLeaves[Cell]);
+                    unsigned int size = getIntersection (across,down,candidates[Cell]);
+                    options.first = candidates[Cell].data();
+                    options.last = candidates[Cell].data() + size;
+                }
+                
+                for (unsigned int c = 0;c<options.size();c++)
+                {
+                    unsigned int word = options[c];
+                    bool used = false;
+                    for (unsigned int k = 0;k<Cell;k++)
+                    {
+                        used |= current[k] == word;
+                    }
+                    if (used || (Width == Height && Cell == Width && firstSeen (word) < firstSeen (current[1])))
+                    {
+                        continue;
+                    }
+                    current[Cell] = word;
+                    fill <Cell+1> ();
+                }
+            }
+        }
+    };
+    
+    // procedure makes every pane of a root
+    static void searchRoot (const adjacency & trees,unsigned int root,vector <shapedPane> & found)
+    {
+        paneSearch search (trees,found);
+        search.current[0] = root;
+        search.template fill <1> ();
+    }
+    
+    // A square pane is made one way round only, but a stack's later panes may be either way round, so the join takes
+    // those both ways. Other shapes turned over are another shape and are only ever taken as made.
+    static constexpr unsigned int turns = Width == Height ? 2 : 1;
+    
+    // function returns the cell of a square pane that cell k of its transpose holds
+    static constexpr unsigned int turnedCell (unsigned int k)
+    {
+        return (k%Width)*Width + k/Width;
+    }
+    
+    // function returns a square pane flipped about its diagonal, and any other as it is
+    static shapedPane turnPane (const shapedPane & frame)
+    {
+        shapedPane flipped = frame;
+        if constexpr (Width == Height)
+        {
+            for (unsigned int k = 0;k<cells;k++)
+            {
+                flipped[k] = frame[turnedCell (k)];
+            }
+        }
+        return flipped;
+    }
+    
+    // every layer's panes back to back in root order, indexed by each cell for the join
+    struct stackingSide
+    {
+        vector <shapedPane> panes;
+        cellIndex <cells> index;
+    };
+    
+    // the working space of one layer of the join: the decoded followers of every cell and the panes they probe
+    struct layerScratch
+    {
+        intVector leaves [cells];
+        intVector candidates;
+    };
+    typedef array <layerScratch,Depth> stackScratch;
+    
+    // procedure stacks panes onto layers [0, Layer) of next. A pane can go on next if every cell's word follows the
+    // words under it, so like stackPane each way round is probed through the cell whose followers hold the fewest
+    // panes, the other cells are checked to line up, and a full stack has no repeats. A candidate is a pane times
+    // turns plus which way round, so in order they are panes in root order, each before its transpose.
+    template <unsigned int Layer>
+    static void stackFrom (const adjacency & trees,const stackingSide & side,shapedStack & next,stackScratch & scratch,vector <shapedStack> & stacks)
+    {
+        if constexpr (Layer == Depth)
+        {
+            if (distinctWords (next[0].data(),cells * Depth))
+            {
+                stacks.push_back (next);
+            }
+        }
+        else
+        {
+            constexpr unsigned int order = Layer < 2 ? Layer+1 : 3;
+            layerScratch & here = scratch[Layer];
+            
+            // the layers so far have lined up, so every cell's column is a gram with followers
+            idSpan allowed [cells];
+            for (unsigned int cell = 0;cell<cells;cell++)
+            {
+                unsigned int above [order-1];
+                for (unsigned int k = 0;k+1<order;k++)
+                {
+                    above[k] = next[Layer+1-order+k][cell];
+                }
+                allowed[cell] = followers <order-1> (trees,above,here.leaves[cell]);
+            }
+            
+            intVector & candidates = here.candidates;
+            candidates.clear();
+            unsigned int bestCells [turns];
+            for (unsigned int turned = 0;turned<turns;turned++)
+            {
+                unsigned int bestCell = 0;
+                size_t bestCount = candidateCount (side.index,0,allowed[0]);
+                for (unsigned int cell = 1;cell<cells && bestCount > 0;cell++)
+                {
+                    size_t count = candidateCount (side.index,turned ? turnedCell (cell) : cell,allowed[cell]);
+                    if (count < bestCount)
+                    {
+                        bestCell = cell;
+                        bestCount = count;
+                    }
+                }
+                bestCells[turned] = bestCell;
+                size_t from = candidates.size();
+                gatherCandidates (side.index,turned ? turnedCell (bestCell) : bestCell,allowed[bestCell],candidates);
+                for (size_t c = from;c<candidates.size();c++)
+                {
+                    candidates[c] = candidates[c] * turns + turned;
+                }
+            }
+            sort (candidates.begin(),candidates.end());
+            
+            for (size_t c = 0;c<candidates.size();c++)
+            {
+                unsigned int turned = candidates[c] % turns;
+                const shapedPane & stored = side.panes[candidates[c] / turns];
+                shapedPane frame = turned ? turnPane (stored) : stored;
+                bool fits = true;
+                for (unsigned int cell = 0;fits && cell<cells;cell++)
+                {
+                    unsigned int column [order];
+                    for (unsigned int k = 0;k+1<order;k++)
+                    {
+                        column[k] = next[Layer+1-order+k][cell];
+                    }
+                    column[order-1] = frame[cell];
+                    fits = cell == bestCells[turned] || lineUpOrder <order> (column,trees);
+                }
+                if (fits)
+                {
+                    next[Layer] = frame;
+                    stackFrom <Layer+1> (trees,side,next,scratch,stacks);
+                }
+            }
+        }
+    }
+    
+    // procedure writes a stack as a pane after pane of " word" rows and a blank line, or as raw ids in binary mode.
+    // With transposes on, a stack of square panes is followed by its transpose.
+    static void writeStack (const shapedStack & stack,resultWriter & writer,bool turned = false)
+    {
+        if (writer.binary)
+        {
+            writeBytes (writer,(const char *) stack.data(),sizeof (shapedStack));
+        }
+        else
+        {
+            for (unsigned int layer = 0;layer<Depth;layer++)
+            {
+                for (unsigned int row = 0;row<Height;row++)
+                {
+                    for (unsigned int col = 0;col<Width;col++)
+                    {
+                        writeBytes (writer," ",1);
+                        writeWord (writer,stack[layer][row*Width+col]);
+                    }
+                    writeBytes (writer,"\n",1);
+                }
+            }
+            writeBytes (writer,"\n",1);
+        }
+        
+        if (Width == Height && writer.transposes && !turned)
+        {
+            shapedStack flipped;
+            for (unsigned int layer = 0;layer<Depth;layer++)
+            {
+                flipped[layer] = turnPane (stack[layer]);
+            }
+            writeStack (flipped,writer,true);
+        }
+    }
+    
+    // procedure searches every layer's roots, a root at a time between the threads, and then stacks each first pane,
+    // a chunk of them at a time, writing each chunk's stacks in order
+    static void fold (const adjacency & trees,unsigned int seed,unsigned int threads,resultWriter & writer)
+    {
+        vector <unsigned int> layerRoots [3];
+        seedRoots (trees,seed,layerRoots);
+        vector <unsigned int> roots;
+        for (unsigned int layer = 0;layer<Depth;layer++)
+        {
+            roots.insert (roots.end(),layerRoots[layer].begin(),layerRoots[layer].end());
+        }
+        sort (roots.begin(),roots.end());
+        roots.erase (unique (roots.begin(),roots.end()),roots.end());
+        
+        vector <vector <shapedPane> > panesOf (trees.branchOffsets.size() - 1);
+        {
+            traceSpan span ("search");
+            runTasks ((unsigned int) roots.size(),threads,[&] (unsigned int,unsigned int task)
+            {
+                traceSpan rootSpan ("panes",roots[task]);
+                searchRoot (trees,roots[task],panesOf[roots[task]]);
+                metricsHere().panes += panesOf[roots[task]].size();
+            });
+        }
+        
+        const vector <shapedPane> & firsts = panesOf[seed];
+        cerr << firsts.size() << " first panes of " << Width << "x" << Height << ", stacking " << Depth << " deep" << endl;
+        stackingSide side;
+        {
+            traceSpan span ("index panes");
+            for (size_t r = 0;r<roots.size();r++)
+            {
+                side.panes.insert (side.panes.end(),panesOf[roots[r]].begin(),panesOf[roots[r]].end());
+            }
+            buildPaneIndex (side.panes,(unsigned int) panesOf.size(),side.index);
+        }
+        size_t chunk = threads * 4;
+        vector <vector <shapedStack> > found (chunk);
+        vector <stackScratch> scratch (threads);
+        progressMeter progress ("stacked first panes",firsts.size());
+        for (size_t start = 0;start<firsts.size();start += chunk)
+        {
+            size_t end = min (firsts.size(),start + chunk);
+            runTasks ((unsigned int) (end - start),threads,[&] (unsigned int worker,unsigned int task)
+            {
+                traceSpan span ("stack",seed);
+                shapedStack next;
+                next[0] = firsts[start + task];
+                found[task].clear();
+                stackFrom <1> (trees,side,next,scratch[worker],found[task]);
+            });
+            
+            progress.tick (end);
+            for (size_t task = 0;task<end - start;task++)
+            {
+                for (size_t i = 0;i<found[task].size();i++)
+                {
+                    writeStack (found[task][i],writer);
+                }
+            }
+        }
+    }
+};
+
+// function runs the engine for a shape given as WIDTHxHEIGHTxDEPTH, and gives back false if it is not one it was built for
+bool foldShape (const string & shape,const adjacency & trees,unsigned int seed,unsigned int threads,resultWriter & writer)
+{
+    typedef void (* folder) (const adjacency &,unsigned int,unsigned int,resultWriter &);
+    static const pair <const char *,folder> shapes [] =
+    {
+        {"2x2x2",shapeEngine <2,2,2>::fold},
+        {"2x2x3",shapeEngine <2,2,3>::fold},
+        {"2x3x2",shapeEngine <2,3,2>::fold},
+        {"2x3x3",shapeEngine <2,3,3>::fold},
+        {"3x2x2",shapeEngine <3,2,2>::fold},
+        {"3x2x3",shapeEngine <3,2,3>::fold},
+        {"3x3x2",shapeEngine <3,3,2>::fold},
+        {"3x3x3",shapeEngine <3,3,3>::fold},
+    };
+    
+    for (const auto & known : shapes)
+    {
+        if (shape == known.first)
+        {
+            known.second (trees,seed,threads,writer);
+            return true;
+        }
+    }
+    return false;
+}
+
+// The benchmark. It times each stage on a fixed corpus and prints one JSON object on stdout, so runs of two builds
+// can be compared. The corpus is one of
+//   zipf:V:N[:S]     N words drawn from a vocabulary of V with Zipf's law, from random seed S
+//   fanout:K:N[:S]   a random walk of N words that keeps crossing between two sides of K words each. Every word
+//                    is followed by most of the other side, so runs are long and panes many: the worst case.
+//   anything else    a text file, such as fold/resources/text.txt
+// Generated corpora are the same on every machine for the same numbers; zipf:20000:20000 and fanout:40:3000 take
+// seconds. The seed word is the one with the most trigrams unless one is given with --word.
+
+// procedure writes a generated corpus. Gives back false if the spec is not a generator.
+bool generateCorpus (const string & spec,FILE * out)
+{
+    unsigned long long a = 0, b = 0, seed = 1;
+    char kind [16] = {0};
+    int fields = sscanf (spec.c_str(),"%15[a-z]:%llu:%llu:%llu",kind,&a,&b,&seed);
+    if (fields < 3 || a == 0)
+    {
+        return false;
+    }
+    mt19937_64 random (seed);
+    
+    if (string (kind) == "zipf")
+    {
+        vector <double> cumulative (a);
+        double sum = 0;
+        for (unsigned long long r = 0;r<a;r++)
+        {
+            sum += 1.0 / (double) (r+1);
+            cumulative[r] = sum;
+        }
+        uniform_real_distribution <double> draw (0,sum);
+        for (unsigned long long t = 0;t<b;t++)
+        {
+            size_t r = upper_bound (cumulative.begin(),cumulative.end(),draw (random)) - cumulative.begin();
+            fprintf (out,"w%zu%c",min (r,(size_t) a-1),t % 16 == 15 ? '\n' : ' ');
+        }
+        return true;
+    }
+    if (string (kind) == "fanout")
+    {
+        uniform_int_distribution <unsigned long long> draw (0,a-1);
+        for (unsigned long long t = 0;t<b;t++)
+        {
+            fprintf (out,"%c%llu%c",t % 2 ? 'y' : 'x',draw (random),t % 16 == 15 ? '\n' : ' ');
+        }
+        return true;
+    }
+    return false;
+}
+
+// function quotes text for JSON
+string jsonString (string_view text)
+{
+    string quoted = "\"";
+    for (size_t i = 0;i<text.size();i++)
+    {
+        unsigned char c = (unsigned char) text[i];
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += (char) c;
+        }
+        else if (c < 0x20)
+        {
+            char escaped [8];
+            snprintf (escaped,sizeof (escaped),"\\u%04x",c);
+            quoted += escaped;
+        }
+        else
+        {
+            quoted += (char) c;
+        }
+    }
+    return quoted + "\"";
+}
+
+double secondsSince (chrono::steady_clock::time_point start)
+{
+    return chrono::duration <double> (chrono::steady_clock::now() - start).count();
+}
+
+// function adds up every thread's counters. Root records and trace events stay with their threads.
+threadMetrics sumMetrics ()
+{
+    threadMetrics total;
+    lock_guard <mutex> hold (metrics.lock);
+    for (size_t t = 0;t<metrics.threads.size();t++)
+    {
+        const threadMetrics & one = *metrics.threads[t];
+        for (unsigned int b = 0;b<sizeBuckets;b++)
+        {
+            total.intersections[b] += one.intersections[b];
+        }
+        total.checks += one.checks;
+        total.checksPassed += one.checksPassed;
+        total.checkTwos += one.checkTwos;
+        total.checkTwosPassed += one.checkTwosPassed;
+        total.panes += one.panes;
+        total.bytesAllocated += one.bytesAllocated;
+        total.buffersGrown += one.buffersGrown;
+    }
+    return total;
+}
+
+// procedure prints the counters on stderr, with the roots that took longest
+void reportMetrics (const vocabulary & dictionary)
+{
+    threadMetrics total = sumMetrics();
+    
+    cerr << "intersections by shorter run:";
+    for (unsigned int b = 0;b<sizeBuckets;b++)
+    {
+        if (total.intersections[b])
+        {
+            cerr << " " << (b ? 1u << (b-1) : 0) << (b+1 == sizeBuckets ? "+" : "") << ": " << total.intersections[b];
+        }
+    }
+    cerr << endl;
+    cerr << "check passed " << total.checksPassed << " of " << total.checks << ", checkTwo passed " << total.checkTwosPassed << " of " << total.checkTwos << endl;
+    cerr << "panes " << total.panes << ", searched bytes allocated " << total.bytesAllocated << " in " << total.buffersGrown << " buffer growths" << endl;
+    
+    // a root may have been searched in several ranges, on several threads
+    vector <rootRecord> roots;
+    {
+        lock_guard <mutex> hold (metrics.lock);
+        for (size_t t = 0;t<metrics.threads.size();t++)
+        {
+            roots.insert (roots.end(),metrics.threads[t]->roots.begin(),metrics.threads[t]->roots.end());
+        }
+    }
+    sort (roots.begin(),roots.end(),[] (const rootRecord & x,const rootRecord & y) { return x.root < y.root; });
+    vector <rootRecord> byRoot;
+    for (size_t r = 0;r<roots.size();r++)
+    {
+        if (byRoot.empty() || byRoot.back().root != roots[r].root)
+        {
+            byRoot.push_back (roots[r]);
+            continue;
+        }
+        byRoot.back().panes += roots[r].panes;
+        byRoot.back().microseconds += roots[r].microseconds;
+    }
+    sort (byRoot.begin(),byRoot.end(),[] (const rootRecord & x,const rootRecord & y) { return x.microseconds > y.microseconds; });
+    for (size_t r = 0;r<byRoot.size() && r<10;r++)
+    {
+        cerr << "hot root " << dictionary.words[byRoot[r].root] << ": " << byRoot[r].panes << " panes in " << byRoot[r].microseconds << "us" << endl;
+    }
+}
+
+// procedure writes every kept span as a Chrome trace
+bool writeTrace (const string & name,const vocabulary & dictionary)
+{
+    FILE * out = fopen (name.c_str(),"w");
+    if (!out)
+    {
+        return false;
+    }
+    fprintf (out,"{\"traceEvents\": [\n");
+    bool first = true;
+    lock_guard <mutex> hold (metrics.lock);
+    for (size_t t = 0;t<metrics.threads.size();t++)
+    {
+        const threadMetrics & one = *metrics.threads[t];
+        for (size_t e = 0;e<one.events.size();e++)
+        {
+            const traceEvent & event = one.events[e];
+            fprintf (out,"%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %llu, \"dur\": %llu",first ? "" : ",\n",event.name,one.thread,event.start,event.duration);
+            if (event.root != ~0u)
+            {
+                fprintf (out,", \"args\": {\"root\": %s}",jsonString (dictionary.words[event.root]).c_str());
+            }
+            fprintf (out,"}");
+            first = false;
+        }
+    }
+    fprintf (out,"\n]}\n");
+    return fclose (out) == 0;
+}
+
+// procedure puts out whatever metrics were asked for, at the end of a run
+void finishMetrics (bool report,const string & traceName,const vocabulary & dictionary)
+{
+    if (report)
+    {
+        reportMetrics (dictionary);
+    }
+    if (!traceName.empty() && !writeTrace (traceName,dictionary))
+    {
+        cerr << "could not write " << traceName << endl;
+    }
+}
+
+// function runs the benchmark and gives back the exit code for main
+int runBenchmark (const string & spec,const string & word,unsigned int threads,const loadOptions & options,const string & outputName,bool reportCounts,const string & traceName)
+{
+    string corpusName = spec;
+    bool generated = false;
+    char temporary [] = "/tmp/fold-bench-XXXXXX";
+    int corpusFd = mkstemp (temporary);
+    if (corpusFd >= 0)
+    {
+        FILE * out = fdopen (corpusFd,"w");
+        generated = generateCorpus (spec,out);
+        fclose (out);
+        if (generated)
+        {
+            corpusName = temporary;
+        }
+        else
+        {
+            unlink (temporary);
+        }
+    }
+    
+    adjacency trees;
+    vocabulary dictionary;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool loaded = load (trees,dictionary,options,corpusName);
+    double loadSeconds = secondsSince (start);
+    if (generated)
+    {
+        unlink (temporary); // the mapping keeps it readable
+    }
+    if (!loaded || dictionary.words.empty())
+    {
+        return 1;
+    }
+    
+    // the seed: the word asked for, or the one with the most trigrams
+    unsigned int seed = 0;
+    if (word.empty())
+    {
+        for (unsigned int w = 1;w<dictionary.words.size();w++)
+        {
+            if (grandchildCount (trees,w) > grandchildCount (trees,seed))
+            {
+                seed = w;
+            }
+        }
+    }
+    else
+    {
+        seed = lookUp (dictionary,word);
+        if (seed == notFound)
+        {
+            cerr << word << " is not in the corpus" << endl;
+            return 1;
+        }
+    }
+    
+    vector <unsigned int> roots [3];
+    seedRoots (trees,seed,roots);
+    paneStore layers [3];
+    double layerSeconds [3];
+    unsigned long long total = 0;
+    for (unsigned int layer = 0;layer<3;layer++)
+    {
+        for (size_t r = 0;r<roots[layer].size();r++)
+        {
+            total += rootCost (trees,roots[layer][r]);
+        }
+    }
+    unsigned long long grain = total / (threads * 64ull) + 1;
+    
+    for (unsigned int layer = 0;layer<3;layer++)
+    {
+        start = chrono::steady_clock::now();
+        vector <squareTask> tasks;
+        for (size_t r = 0;r<roots[layer].size();r++)
+        {
+            splitRoot (trees,layer,roots[layer][r],grain,tasks);
+        }
+        vector <paneStore *> into (3,&layers[layer]);
+        getSquares (trees,tasks,threads,into);
+        layerSeconds[layer] = secondsSince (start);
+    }
+    double searchSeconds = layerSeconds[0] + layerSeconds[1] + layerSeconds[2];
+    
+    // stacks are kept back so that writing them is timed on its own
+    start = chrono::steady_clock::now();
+    stackingSide side;
+    buildStackingSide (layers[1],layers[2],(unsigned int) dictionary.words.size(),side);
+    stackScratch scratch;
+    vector <paneStack> stacks;
+    function <void (const pane &,const pane &,const pane &)> found = [&] (const pane & first,const pane & second,const pane & third)
+    {
+        if (isRepeatFree (first,second,third))
+        {
+            paneStack next;
+            next.first = first;
+            next.second = second;
+            next.third = third;
+            stacks.push_back (next);
+        }
+    };
+    for (size_t a = 0;a<layers[0].size();a++)
+    {
+        stackPane (trees,layers[0][a],side,scratch,found);
+    }
+    double stackSeconds = secondsSince (start);
+    
+    int outputFd = open (outputName.empty() ? "/dev/null" : outputName.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+    if (outputFd < 0)
+    {
+        cerr << "could not open " << (outputName.empty() ? "/dev/null" : outputName) << endl;
+        return 1;
+    }
+    start = chrono::steady_clock::now();
+    resultWriter writer;
+    openWriter (writer,outputFd,false,dictionary);
+    for (size_t i = 0;i<stacks.size();i++)
+    {
+        outPutStack (stacks[i].first,stacks[i].second,stacks[i].third,writer);
+    }
+    flushWriter (writer);
+    close (outputFd);
+    double outputSeconds = secondsSince (start);
+    
+    struct rusage usage;
+    getrusage (RUSAGE_SELF,&usage);
+    
+    unsigned long long panes = layers[0].size() + layers[1].size() + layers[2].size();
+    threadMetrics counted = sumMetrics(); // nothing intersects while stacking, so these are the search's
+    unsigned long long intersections = 0;
+    for (unsigned int b = 0;b<sizeBuckets;b++)
+    {
+        intersections += counted.intersections[b];
+    }
+    
+    printf ("{\n");
+    printf ("  \"corpus\": %s,\n",jsonString (spec).c_str());
+    printf ("  \"corpusBytes\": %zu,\n",dictionary.file.size);
+    printf ("  \"vocabulary\": %zu,\n",dictionary.words.size());
+    printf ("  \"seed\": %s,\n",jsonString (dictionary.words[seed]).c_str());
+    printf ("  \"threads\": %u,\n",threads);
+    printf ("  \"bloom\": %s,\n",options.withBloom ? "true" : "false");
+    printf ("  \"relabeled\": %s,\n",options.byFrequency ? "true" : "false");
+    printf ("  \"compressed\": %s,\n",options.compress ? "true" : "false");
+    printf ("  \"seconds\": {\"load\": %.6f, \"firstPanes\": %.6f, \"secondPanes\": %.6f, \"thirdPanes\": %.6f, \"stack\": %.6f, \"output\": %.6f},\n",
+            loadSeconds,layerSeconds[0],layerSeconds[1],layerSeconds[2],stackSeconds,outputSeconds);
+    printf ("  \"panes\": [%zu, %zu, %zu],\n",layers[0].size(),layers[1].size(),layers[2].size());
+    printf ("  \"panesPerSecond\": %.1f,\n",searchSeconds > 0 ? panes / searchSeconds : 0.0);
+    printf ("  \"intersections\": %llu,\n",intersections);
+    printf ("  \"intersectionsPerSecond\": %.1f,\n",searchSeconds > 0 ? intersections / searchSeconds : 0.0);
+    printf ("  \"intersectionsByShorterRun\": [");
+    for (unsigned int b = 0;b<sizeBuckets;b++)
+    {
+        printf ("%s%llu",b ? ", " : "",counted.intersections[b]);
+    }
+    printf ("],\n");
+    printf ("  \"checks\": {\"run\": %llu, \"passed\": %llu},\n",counted.checks,counted.checksPassed);
+    printf ("  \"checkTwos\": {\"run\": %llu, \"passed\": %llu},\n",counted.checkTwos,counted.checkTwosPassed);
+    printf ("  \"bytesAllocated\": %llu,\n",counted.bytesAllocated);
+    printf ("  \"buffersGrown\": %llu,\n",counted.buffersGrown);
+    printf ("  \"stacks\": %zu,\n",stacks.size());
+    printf ("  \"peakRssKilobytes\": %ld\n",usage.ru_maxrss);
+    printf ("}\n");
+    
+    finishMetrics (reportCounts,traceName,dictionary);
+    return 0;
+}
+
+int main(int argc, char * argv[])
+{
+    
+    vocabulary dictionary;
+    adjacency trees;
+    paneStore frameOneRootResults;
+    paneStore frameTwoRootResults;
+    paneStore frameThreeRootResults;
+    string inputWord;
+    
+    // given with --word. The search starts from God when it is not.
+    string benchSpec; // empty means no benchmark
+    
+    unsigned int threads = thread::hardware_concurrency();
+    loadOptions options;
+    string snapshotName; // empty means no snapshot
+    bool verifySnapshot = false;
+    bool binary = false;
+    string outputName; // empty means stdout
+    bool pipelined = false;
+    bool constrained = false;
+    bool transposes = false;
+    bool reportCounts = false;
+    string traceName; // empty means no trace
+    string seedsName; // a file of seed words for batch mode
+    string shape; // empty means three 3x3 panes on the tuned paths
+    bool delta = false;
+    stackQuery query;
+    string checkpointName; // empty means no checkpoints
+    double checkpointEvery = 60;
+    bool resume = false;
+    unsigned int shards = 0; // zero means one machine
+    unsigned int shard = notFound; // set on a shard, which only searches
+    vector <string> shardNames; // shard files for the coordinator
+    unsigned int groupSize = 16; // seeds whose roots are searched together
+    size_t cacheMegabytes = 1024;
+    pipelineOptions pipeline;
+    pipeline.producers = 0; // zero means the thread count
+    pipeline.joiners = 0;
+    pipeline.queueBatches = 64;
+    pipeline.batchPanes = 256;
+    for (int arg = 1;arg<argc;arg++)
+    {
+        if (string (argv[arg]) == "--threads" && arg+1<argc)
+        {
+            threads = (unsigned int) atoi (argv[++arg]);
+        }
+        else if (string (argv[arg]) == "--bloom")
+        {
+            options.withBloom = true;
+        }
+        else if (string (argv[arg]) == "--relabel")
+        {
+            options.byFrequency = true;
+        }
+        else if (string (argv[arg]) == "--compress")
+        {
+            options.compress = true;
+        }
+        else if (string (argv[arg]) == "--snapshot" && arg+1<argc)
+        {
+            snapshotName = argv[++arg];
+        }
+        else if (string (argv[arg]) == "--verify-snapshot")
+        {
+            verifySnapshot = true;
+        }
+        else if (string (argv[arg]) == "--output" && arg+1<argc)
+        {
+            outputName = argv[++arg];
+        }
+        else if (string (argv[arg]) == "--binary")
+        {
+            binary = true;
+        }
+        else if (string (argv[arg]) == "--pipeline")
+        {
+            pipelined = true;
+        }
+        else if (string (argv[arg]) == "--producers" && arg+1<argc)
+        {
+            pipeline.producers = (unsigned int) atoi (argv[++arg]);
+        }
+        else if (string (argv[arg]) == "--joiners" && arg+1<argc)
+        {
+            pipeline.joiners = (unsigned int) atoi (argv[++arg]);
+        }
+        else if (string (argv[arg]) == "--word" && arg+1<argc)
+        {
+            inputWord = argv[++arg];
+        }
+        else if (string (argv[arg]) == "--bench" && arg+1<argc)
+        {
+            benchSpec = argv[++arg];
+        }
+        else if (string (argv[arg]) == "--metrics")
+        {
+            reportCounts = true;
+        }
+        else if (string (argv[arg]) == "--trace" && arg+1<argc)
+        {
+            traceName = argv[++arg];
+        }
+        else if (string (argv[arg]) == "--transposes")
+        {
+            transposes = true;
+        }
+        else if (string (argv[arg]) == "--constrained")
+        {
+            constrained = true;
+        }
+        else if (string (argv[arg]) == "--seeds" && arg+1<argc)
+        {
+            seedsName = argv[++arg];
+        }
+        else if (string (argv[arg]) == "--group" && arg+1<argc)
+        {
+            groupSize = (unsigned int) atoi (argv[++arg]);
+        }
+        else if (string (argv[arg]) == "--cache" && arg+1<argc)
+        {
+            cacheMegabytes = (size_t) atol (argv[++arg]);
+        }
+        else if (string (argv[arg]) == "--shards" && arg+1<argc)
+        {
+            shards = (unsigned int) atoi (argv[++arg]);
+        }
+        else if (string (argv[arg]) == "--shard" && arg+1<argc)
+        {
+            shard = (unsigned int) atoi (argv[++arg]);
+        }
+        else if (string (argv[arg]) == "--gather" && arg+1<argc)
+        {
+            shardNames.push_back (argv[++arg]);
+        }
+        else if (string (argv[arg]) == "--limit" && arg+1<argc)
+        {
+            query.limit = (size_t) atol (argv[++arg]);
+        }
+        else if (string (argv[arg]) == "--score")
+        {
+            query.scored = true;
+        }
+        else if (string (argv[arg]) == "--checkpoint" && arg+1<argc)
+        {
+            checkpointName = argv[++arg];
+        }
+        else if (string (argv[arg]) == "--checkpoint-every" && arg+1<argc)
+        {
+            checkpointEvery = atof (argv[++arg]);
+        }
+        else if (string (argv[arg]) == "--resume")
+        {
+            resume = true;
+        }
+        else if (string (argv[arg]) == "--delta")
+        {
+            delta = true;
+        }
+        else if (string (argv[arg]) == "--shape" && arg+1<argc)
+        {
+            shape = argv[++arg];
+        }
+        else if (string (argv[arg]) == "--queue" && arg+1<argc)
+        {
+            pipeline.queueBatches = (size_t) atol (argv[++arg]);
+        }
+    }
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (groupSize < 1)
+    {
+        groupSize = 1;
+    }
+    
+    metrics.tracing = !traceName.empty();
+    if (query.scored && query.limit == 0)
+    {
+        cerr << "--score ranks the best --limit stacks, so it needs a limit" << endl;
+        return 1;
+    }
+    if (query.limit > 0 && (!seedsName.empty() || !shape.empty() || shards > 0))
+    {
+        cerr << "--limit only works on one seed's three 3x3 panes, on one machine" << endl;
+        return 1;
+    }
+    if (resume && checkpointName.empty())
+    {
+        cerr << "--resume needs the --checkpoint to resume from" << endl;
+        return 1;
+    }
+    if (!checkpointName.empty() && (outputName.empty() || !seedsName.empty() || !shape.empty() || shards > 0 || pipelined || constrained || query.limit > 0))
+    {
+        cerr << "--checkpoint works on one seed's plain search, one machine, with --output naming the file to resume" << endl;
+        return 1;
+    }
+    
+    if (!benchSpec.empty())
+    {
+        return runBenchmark (benchSpec,inputWord,threads,options,outputName,reportCounts,traceName);
+    }
+    if (inputWord.empty())
+    {
+        inputWord = "God";
+    }
+    if (pipeline.producers < 1)
+    {
+        pipeline.producers = threads;
+    }
+    if (pipeline.joiners < 1)
+    {
+        pipeline.joiners = threads;
+    }
+    
+    // a good snapshot saves the whole load, and one of a corpus that has since grown only needs the new words added.
+    // Without one, load. Either way a changed index leaves a snapshot for next time.
+    vector <trigram> added; // the triples new since the snapshot
+    bool changed = true;
+    if (!snapshotName.empty() && openSnapshot (snapshotName,trees,dictionary,options,verifySnapshot))
+    {
+        cerr << "snapshot loaded" << endl;
+        changed = dictionary.indexed < dictionary.file.size;
+        if (changed)
+        {
+            cerr << "input.txt has grown by " << dictionary.file.size - dictionary.indexed << " bytes since the snapshot" << endl;
+            appendCorpus (trees,dictionary,options,added);
+        }
+    }
+    else
+    {
+        if (!load (trees,dictionary,options))
+        {
+            return 1;
+        }
+        if (delta)
+        {
+            cerr << "no snapshot to compare with, so every stack is new" << endl;
+            delta = false;
+        }
+    }
+    if (!snapshotName.empty() && changed)
+    {
+        if (saveSnapshot (snapshotName,trees,dictionary))
+        {
+            cerr << "snapshot written to " << snapshotName << endl;
+        }
+        else
+        {
+            cerr << "could not write snapshot " << snapshotName << endl;
+        }
+    }
+    
+    // results go to stdout unless a file is named. Progress goes to stderr, so stdout only ever holds results.
+    int outputFd = 1;
+    if (!outputName.empty())
+    {
+        outputFd = open (outputName.c_str(),O_WRONLY | O_CREAT | (resume ? 0 : O_TRUNC),0644); // a resumed run is cut back to its checkpoint
+        if (outputFd < 0)
+        {
+            cerr << "could not open " << outputName << endl;
+            return 1;
+        }
+    }
+    resultWriter writer;
+    openWriter (writer,outputFd,binary,dictionary);
+    writer.transposes = transposes;
+    
+    // the delta mode only writes stacks that read a triple new since the snapshot, and only stacks seeds that can have one
+    vector <bool> touched;
+    if (delta)
+    {
+        touchedSeeds (trees,added,touched);
+        writer.keep = [&] (const pane & first,const pane & second,const pane & third)
+        {
+            return readsAny (first,second,third,added);
+        };
+    }
+    
+    // batch mode: many seeds, one process, panes shared through the cache
+    if (!seedsName.empty())
+    {
+        ifstream seedFile (seedsName.c_str());
+        if (!seedFile)
+        {
+            cerr << "could not open " << seedsName << endl;
+            return 1;
+        }
+        vector <unsigned int> seeds;
+        string word;
+        while (seedFile >> word)
+        {
+            unsigned int seed = lookUp (dictionary,word);
+            if (seed == notFound)
+            {
+                cerr << word << " is not in the corpus, skipped" << endl;
+                continue;
+            }
+            if (delta && !touched[seed])
+            {
+                continue; // its stacks are the ones it had
+            }
+            seeds.push_back (seed);
+        }
+        if (delta)
+        {
+            cerr << seeds.size() << " seeds may have new stacks" << endl;
+        }
+        
+        stackSeeds (trees,dictionary,seeds,groupSize,threads,cacheMegabytes << 20,writer);
+        
+        flushWriter (writer);
+        if (outputFd != 1)
+        {
+            close (outputFd);
+        }
+        finishMetrics (reportCounts,traceName,dictionary);
+        cerr << "search complete\n";
+        return 0;
+    }
+    
+    unsigned int seed = lookUp (dictionary,inputWord);
+    if (seed == notFound)
+    {
+        cerr << inputWord << " is not in the corpus" << endl;
+        return 1;
+    }
+    if (delta && !touched[seed])
+    {
+        cerr << "nothing added can reach a stack of " << inputWord << ", so it has no new stacks" << endl;
+        if (outputFd != 1)
+        {
+            close (outputFd);
+        }
+        finishMetrics (reportCounts,traceName,dictionary);
+        return 0;
+    }
+    
+    if (shards > 0)
+    {
+        if (shard != notFound && shard >= shards)
+        {
+            cerr << "--shard is counted from 0, below --shards" << endl;
+            return 1;
+        }
+        if (shard != notFound)
+        {
+            writeShard (trees,dictionary,seed,shards,shard,threads,writer);
+        }
+        else
+        {
+            gatherShards (trees,dictionary,seed,shards,shardNames,threads,writer);
+        }
+        
+        flushWriter (writer);
+        if (outputFd != 1)
+        {
+            close (outputFd);
+        }
+        finishMetrics (reportCounts,traceName,dictionary);
+        cerr << "search complete\n";
+        return 0;
+    }
+    
+    if (!shape.empty())
+    {
+        if (delta)
+        {
+            cerr << "--delta only works on three 3x3 panes" << endl;
+            return 1;
+        }
+        if (!foldShape (shape,trees,seed,threads,writer))
+        {
+            cerr << "no engine for shape " << shape << ", the sides and the depth are each 2 or 3" << endl;
+            return 1;
+        }
+        
+        flushWriter (writer);
+        if (outputFd != 1)
+        {
+            close (outputFd);
+        }
+        finishMetrics (reportCounts,traceName,dictionary);
+        cerr << "search complete\n";
+        return 0;
+    }
+    
+    // the seed roots the first panes, its children the second, and its grandchildren the third.
+    // Every root of every layer goes into one batch, so the threads stay busy across layers.
+    vector <unsigned int> roots [3];
+    seedRoots (trees,seed,roots);
+    
+    unsigned long long total = 0;
+    for (unsigned int layer = 0;layer<3;layer++)
+    {
+        for (unsigned int r = 0;r<roots[layer].size();r++)
+        {
+            total += rootCost (trees,roots[layer][r]);
+        }
+    }
+    unsigned long long grain = total / (threads * 64ull) + 1; // many more tasks than threads, so stealing can even out the skew
+    if (!checkpointName.empty())
+    {
+        grain = total / checkpointTasks + 1; // the same tasks on any machine, so a journal can be resumed anywhere
+    }
+    
+    vector <squareTask> tasks;
+    vector <squareTask> firstTasks; // the first panes stream in the pipelined mode, so they are searched separately
+    if (query.limit > 0)
+    {
+        constrained = true; // a query stacks first pane by first pane, so it can stop
+        pipelined = false;
+    }
+    for (unsigned int layer = 0;layer < (constrained ? 1u : 3u);layer++) // the constrained mode searches only the first layer in full
+    {
+        for (unsigned int r = 0;r<roots[layer].size();r++)
+        {
+            splitRoot (trees,layer,roots[layer][r],grain,pipelined && layer == 0 ? firstTasks : tasks);
+        }
+    }
+    
+    vector <paneStore *> layers;
+    layers.push_back (&frameOneRootResults);
+    layers.push_back (&frameTwoRootResults);
+    layers.push_back (&frameThreeRootResults);
+    
+    if (constrained)
+    {
+        cerr << "get the first panes" << endl;
+        getSquares (trees,tasks,threads,layers);
+        
+        cerr << "stack the squares, searching under each first pane" << endl;
+        if (query.scored)
+        {
+            bestStacks (trees,dictionary,frameOneRootResults,threads,query.limit,writer);
+        }
+        else if (query.limit > 0)
+        {
+            firstStacks (trees,frameOneRootResults,threads,query.limit,writer);
+        }
+        else
+        {
+            stackConstrained (trees,frameOneRootResults,threads,writer);
+        }
+    }
+    else if (pipelined)
+    {
+        cerr << "get the second and third panes" << endl;
+        getSquares (trees,tasks,threads,layers);
+        
+        cerr << "stream the first panes and stack the squares" <<endl;
+        stackPipeline (trees,(unsigned int) dictionary.words.size(),firstTasks,frameTwoRootResults,frameThreeRootResults,pipeline,writer);
+    }
+    else if (!checkpointName.empty())
+    {
+        checkpointHeader header;
+        memset (&header,0,sizeof (header));
+        memcpy (header.magic,checkpointMagic,sizeof (checkpointMagic));
+        header.version = checkpointVersion;
+        header.seed = seed;
+        header.corpusChecksum = quickChecksum (dictionary.file);
+        header.planChecksum = planChecksum (tasks);
+        header.tasks = (unsigned int) tasks.size();
+        header.output = binary | transposes << 1 | delta << 2 | dictionary.byFrequency << 3;
+        
+        checkpointLog log;
+        log.outputFd = outputFd;
+        log.every = checkpointEvery;
+        if (!openCheckpoint (log,checkpointName,header,resume))
+        {
+            return 1;
+        }
+        if (ftruncate (outputFd,(off_t) log.resumed.outputBytes) != 0 || lseek (outputFd,0,SEEK_END) < 0)
+        {
+            cerr << "could not cut " << outputName << " back to its checkpoint" << endl;
+            return 1;
+        }
+        writer.flushed = log.resumed.outputBytes;
+        
+        cerr << "get the first, second and third panes" << endl;
+        getSquares (trees,tasks,threads,layers,&log);
+        
+        cerr << "stack the squares" <<endl;
+        stackSquares (trees,(unsigned int) dictionary.words.size(),frameOneRootResults,frameTwoRootResults,frameThreeRootResults,writer,&log);
+        closeCheckpoint (log,checkpointName,true);
+    }
+    else
+    {
+        cerr << "get the first, second and third panes" << endl;
+        getSquares (trees,tasks,threads,layers);
+        
+        cerr << "stack the squares" <<endl;
+        stackSquares (trees,(unsigned int) dictionary.words.size(),frameOneRootResults,frameTwoRootResults,frameThreeRootResults,writer);
+    }
+    
+    flushWriter (writer);
+    if (outputFd != 1)
+    {
+        close (outputFd);
+    }
+    finishMetrics (reportCounts,traceName,dictionary);
+    cerr << "search complete\n";
     return 0;
 }
\ No newline at end of file
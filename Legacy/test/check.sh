@@ -0,0 +1,169 @@
+#!/bin/bash
+# Checks fold on the small corpus here. input.txt is a few planted cubes in noise, and added.txt one more cube to
+# append for the delta run. expected.txt and expected-transposes.txt are the default output with and without
+# --transposes, and reference.py finds the same stacks by brute force. Every other mode and every round trip is
+# checked against the default: the same bytes where it promises the same order, the same stacks where it does not.
+# usage: check.sh [fold binary], which builds ../fold.cpp when no binary is given
+here="$(cd "$(dirname "$0")" && pwd)"
+work="$(mktemp -d)"
+trap 'rm -rf "$work"' EXIT
+
+if [ -n "$1" ]; then
+    fold="$(cd "$(dirname "$1")" && pwd)/$(basename "$1")"
+else
+    fold="$work/fold"
+    g++ -std=c++17 -O3 -pthread "$here/../fold.cpp" -o "$fold" || exit 1
+fi
+cp "$here/input.txt" "$work/"
+cd "$work"
+
+failures=0
+
+# procedure reports whether two files are the same
+same ()
+{
+    if cmp -s "$2" "$3"; then
+        echo "ok    $1"
+    else
+        echo "FAIL  $1"
+        failures=$((failures+1))
+    fi
+}
+
+# procedure prints the stacks of text output one per line, sorted, the way reference.py prints them
+stacks ()
+{
+    python3 - "$1" <<'EOF'
+import sys
+found = []
+words = []
+for line in open (sys.argv[1]):
+    if line.startswith ('seed '):
+        continue
+    if line.strip():
+        words += line.split()
+    elif words:
+        found.append (' '.join (words))
+        words = []
+for stack in sorted (found):
+    print (stack)
+EOF
+}
+
+# procedure prints the summed corpus counts of the stacks of text output, in its order, or just the best count of them
+scores ()
+{
+    python3 - "$@" <<'EOF'
+import sys
+from collections import Counter
+counts = Counter (open ('input.txt').read().split())
+found = [sum (counts[w] for w in stack.split()) for stack in open (sys.argv[1]).read().split ('\n\n')[:-1]]
+if len (sys.argv) > 2:
+    found = sorted (found,reverse = True)[:int (sys.argv[2])]
+for score in found:
+    print (score)
+EOF
+}
+
+run ()
+{
+    "$fold" "$@" 2>/dev/null
+}
+
+# the default run, against what is checked in and against the brute force
+run > default.txt
+same "default output" default.txt "$here/expected.txt"
+python3 "$here/reference.py" input.txt > reference.txt
+stacks default.txt > found.txt
+same "default stacks against the reference" found.txt reference.txt
+run --transposes > transposes.txt
+same "--transposes output" transposes.txt "$here/expected-transposes.txt"
+python3 "$here/reference.py" input.txt --transposes > reference-transposes.txt
+stacks transposes.txt > found.txt
+same "--transposes stacks against the reference" found.txt reference-transposes.txt
+
+# the alternate paths write the same stacks in the same order
+for mode in "--constrained" "--bloom" "--compress" "--threads 1 --pipeline" "--threads 3" "--bloom --compress --constrained"; do
+    run $mode > mode.txt
+    same "$mode" mode.txt default.txt
+done
+
+# relabeling and a pipeline with more than one thread write them in another order
+for mode in "--relabel" "--threads 3 --pipeline" "--relabel --constrained" "--relabel --threads 3 --pipeline"; do
+    run $mode > mode.txt
+    stacks mode.txt > found.txt
+    same "$mode stacks" found.txt reference.txt
+done
+
+# the shape engine, through 3x3x3 and through shapes the default has no path for
+for shape in 3x3x3 3x3x2 2x3x2 3x2x3; do
+    run --shape $shape > mode.txt
+    stacks mode.txt > found.txt
+    python3 "$here/reference.py" input.txt --shape=$shape > shape.txt
+    same "--shape $shape stacks against the reference" found.txt shape.txt
+done
+
+# queries: unscored the first stacks a full run writes, scored the best of them, best first. Scored ties go by the
+# order the query takes first panes in, not the default's, so those are checked by score.
+run --limit 5 > mode.txt
+head -n 50 default.txt > first.txt
+same "--limit 5" mode.txt first.txt
+run --limit 500 > mode.txt
+same "--limit 500" mode.txt default.txt
+run --limit 5 --score > mode.txt
+scores mode.txt > found.txt
+scores default.txt 5 > first.txt
+same "--limit 5 --score, the best scores" found.txt first.txt
+stacks mode.txt > found.txt
+comm -23 found.txt reference.txt > first.txt
+same "--limit 5 --score, all stacks of the seed" first.txt /dev/null
+
+# a checkpointed run killed part way, by a file size limit on its journal, resumes to the same output
+rm -f journal resumed.txt
+{ ( ulimit -f 8; exec "$fold" --checkpoint journal --checkpoint-every 0.0001 --output resumed.txt ); } 2>/dev/null
+[ -s journal ] || { echo "FAIL  the killed run left no journal"; failures=$((failures+1)); }
+run --checkpoint journal --checkpoint-every 0.0001 --output resumed.txt --resume
+same "--checkpoint-every then --resume" resumed.txt default.txt
+[ -e journal ] && { echo "FAIL  the finished run left its journal"; failures=$((failures+1)); }
+
+# shard files gathered, all of them and with one missing, which the coordinator searches itself
+for shard in 0 1 2; do
+    run --shards 3 --shard $shard --output shard$shard
+done
+run --shards 3 --gather shard0 --gather shard1 --gather shard2 > mode.txt
+same "--shards 3 gathered" mode.txt default.txt
+run --shards 3 --gather shard0 --gather shard2 > mode.txt
+same "--shards 3 gathered with shard 1 missing" mode.txt default.txt
+
+# batch mode writes each seed's stacks after a line naming it, as runs of their own would
+printf "w3 God\nw40 missing\n" > seeds.txt
+for seed in w3 God w40; do
+    echo "seed $seed"
+    run --word $seed
+done > first.txt
+run --seeds seeds.txt > mode.txt
+same "--seeds" mode.txt first.txt
+run --seeds seeds.txt --group 1 --cache 0 > mode.txt
+same "--seeds, a seed to a group and no cache" mode.txt first.txt
+
+# a snapshot warm starts to the same output, and once the corpus grows --delta writes just the stacks it gained
+rm -f index.snap
+run --snapshot index.snap > mode.txt
+same "--snapshot, written" mode.txt default.txt
+run --snapshot index.snap > mode.txt
+same "--snapshot, read" mode.txt default.txt
+cat "$here/added.txt" >> input.txt
+python3 "$here/reference.py" input.txt > grown.txt
+run --snapshot index.snap --delta > mode.txt
+stacks mode.txt > found.txt
+comm -23 grown.txt reference.txt > gained.txt
+same "--delta stacks against the reference" found.txt gained.txt
+run --snapshot index.snap > mode.txt
+stacks mode.txt > found.txt
+same "--snapshot, appended to" found.txt grown.txt
+
+if [ $failures -gt 0 ]; then
+    echo "$failures failed"
+    exit 1
+fi
+echo "all passed"
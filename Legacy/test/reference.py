@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+# Brute force reference for fold. Every pane of every root a stack can use is made in both orientations, every
+# layer is tried against the ones under it, and the stacks whose words line up and are all different are printed,
+# one per line, sorted. Words are numbered in first seen order, and as in fold a stack of square panes is listed
+# with its first pane the way round that has cell (0,1) before cell (1,0); --transposes adds the rest.
+# --shape=WIDTHxHEIGHTxDEPTH folds other shapes, 3x3x3 by default.
+import sys
+from collections import defaultdict
+
+def main ():
+    args = [a for a in sys.argv[1:] if not a.startswith ('--')]
+    transposes = '--transposes' in sys.argv
+    shape = '3x3x3'
+    for a in sys.argv[1:]:
+        if a.startswith ('--shape='):
+            shape = a[len ('--shape='):]
+    width, height, depth = (int (n) for n in shape.split ('x'))
+    corpus = args[0] if args else 'input.txt'
+    seed = args[1] if len (args) > 1 else 'God'
+
+    words = open (corpus).read().split()
+    ids = {}
+    for w in words:
+        ids.setdefault (w,len (ids))
+    stream = [ids[w] for w in words]
+    name = {i: w for w, i in ids.items()}
+    grams = {2: set (zip (stream,stream[1:])),3: set (zip (stream,stream[1:],stream[2:]))}
+    follow = defaultdict (set)
+    for n in (2,3):
+        for g in grams[n]:
+            follow[g[:-1]].add (g[-1])
+    cells = width * height
+
+    def panes (root):
+        found = []
+        current = [root]
+        def fill (cell):
+            if cell == cells:
+                found.append (tuple (current))
+                return
+            row, col = divmod (cell,width)
+            options = None
+            if col > 0:
+                options = set (follow[tuple (current[cell-col:cell])])
+            if row > 0:
+                down = follow[tuple (current[cell-row*width:cell:width])]
+                options = set (down) if options is None else options & down
+            for w in sorted (options - set (current)):
+                current.append (w)
+                fill (cell+1)
+                current.pop()
+        fill (1)
+        return found
+
+    if seed not in ids:
+        return
+    memo = {}
+    def panesOf (a):
+        if a not in memo:
+            memo[a] = panes (a)
+        return memo[a]
+    byCell = {}
+    def panesWith (a,word):
+        if a not in byCell:
+            byCell[a] = defaultdict (list)
+            for pane in panesOf (a):
+                byCell[a][pane[1]].append (pane)
+        return byCell[a].get (word,[])
+
+    stacks = []
+    def stack (layers):
+        if len (layers) == depth:
+            flat = [w for pane in layers for w in pane]
+            if len (set (flat)) == len (flat):
+                stacks.append (' '.join (name[w] for w in flat))
+            return
+        under = layers[-2:]
+        for root in follow[tuple (pane[0] for pane in under)]:
+            for pane in (p for word in follow[tuple (pane[1] for pane in under)] for p in panesWith (root,word)):
+                if all (tuple (p[k] for p in under) + (pane[k],) in grams[len (under)+1] for k in range (cells)):
+                    stack (layers + [pane])
+
+    for first in panesOf (ids[seed]):
+        if width == height and not transposes and first[1] > first[width]:
+            continue
+        stack ([first])
+    for s in sorted (stacks):
+        print (s)
+
+main()